@@ -60,4 +60,20 @@ void run_command(const string& cmd, const string& input, string& output, string&
   * @param childErr The pipe to return standard error to.
   * @return The handle of the child process started.
   */
-Handle start_command(const string& cmd, const Pipe& childIn, const Pipe& childOut, const Pipe& childErr);
\ No newline at end of file
+Handle start_command(const string& cmd, const Pipe& childIn, const Pipe& childOut, const Pipe& childErr);
+
+/**
+ * Start a command in a new process that keeps running independently of this one,
+ * writing its stdout and stderr to the given log file. The command gets no input.
+  * @param cmd Command reference to start in the background.
+  * @param logPath Path of the file to write the command's output to, which is replaced if it exists.
+  */
+void start_background_command(const string& cmd, const string& logPath);
+
+/**
+ * Get a command that runs the Metro executable this process was started from, rather than whichever
+ * one is found on the PATH, for starting further Metro processes. The path is quoted, so arguments can be appended.
+ * Falls back to "metro" if the path of the executable can't be found.
+ * @return The command.
+ */
+string metro_command();
@@ -30,11 +30,21 @@ struct Command {
 // List of all valid options
 // Keep them in alphabetical order (by name) to make help messages easier to read
 const Option ALL_OPTIONS[] = {
+        {"background", "g", false, "Leave the remaining work to a background process"},
+        {"backoff", "k", true, "Longest number of seconds to wait between prefetches after they fail"},
+        {"branch", "b", true, "Only clone the given branch and its WIP branch"},
+        {"cache-dir", "a", true, "Share objects with other clones through a mirror of the remote kept in the given directory"},
+        {"current", "c", false, "Only sync the current branch"},
+        {"debounce", "e", true, "Seconds the working directory must stay unchanged before watching sync saves it"},
         {"force", "f", false, "Force execution of command ignoring warnings"},
         {"help", "h", false, "Explain how to use command"},
+        {"interval", "i", true, "Repeat every given number of seconds"},
+        {"only", "o", true, "Only sync branches matching the given pattern, which may contain one *"},
         {"pull", "d", false, "Only pull changes, without pushing changes to remote"},
         {"push", "u", false, "Only push changes, without pulling changes from remote. Requires no conflicts"},
+        {"rest", "r", false, "Sync every branch except the current one"},
         {"soft", "s", false, "Delete the last commit without reverting changes in the working directory"},
-        {"version", "v", false, "Print the version of Metro being used"}
+        {"version", "v", false, "Print the version of Metro being used"},
+        {"watch", "w", false, "Keep syncing as the working directory and remote change"}
 };
 
@@ -82,6 +82,15 @@ struct MissingValueException : public CommandArgumentException {
     {}
 };
 
+/**
+ * InvalidValueException should be thrown when an option was given a value it can't accept.
+ */
+struct InvalidValueException : public CommandArgumentException {
+    explicit InvalidValueException(const string arg, const string value):
+            CommandArgumentException(arg, "Invalid value for " + arg + ": " + value)
+    {}
+};
+
 /**
  * MissingFlagException should be thrown when a value was given but no flag was present.
  */
@@ -84,6 +84,13 @@ namespace git {
          */
         [[nodiscard]] git_signature author() const;
 
+        /**
+         * Gets the committer of the commit.
+         *
+         * @return Commit committer as a Signature.
+         */
+        [[nodiscard]] git_signature committer() const;
+
         /**
          * Amend an existing commit by replacing only non-NULL values.
          *
@@ -45,6 +45,26 @@ namespace git {
          */
         string get_string_buf(const string& name);
 
+        /**
+         * Get the value of a boolean config variable.
+         * This function uses the usual C convention of 0 being false and anything else true.
+         * All config files will be looked into, in the order of their defined level.
+         * A higher level means a higher priority. The first occurrence of the variable will be returned here.
+         *
+         * @param name Variable name.
+         * @return Value of variable.
+         */
+        bool get_bool(const string& name);
+
+        /**
+         * Set the value of a string config variable in the config file with the highest level
+         * (usually the local one).
+         *
+         * @param name Variable name.
+         * @param value The string to store.
+         */
+        void set_string(const string& name, const string& value);
+
         /**
          * Get each value of a multivar in a foreach callback
          * The callback will be called on each variable found
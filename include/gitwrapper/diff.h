@@ -103,5 +103,32 @@ namespace git {
          * @return Diff between tree and workdir.
          */
         static Diff tree_to_workdir_with_index(const Repository& repo, const Tree& oldTree, const git_diff_options* opts);
+
+        /**
+         * Create a diff between a tree and repository index.
+         *
+         * This is equivalent to `git diff --cached <treeish>` or if you pass
+         * the HEAD tree, then like `git diff --cached`.
+         *
+         * The tree you pass will be used for the "old_file" side of the delta, and
+         * the index will be used for the "new_file" side of the delta.
+         *
+         * @param repo Repo containing the tree and index.
+         * @param oldTree Tree to diff from.
+         * @param index Index to diff to.
+         * @param opts Options to use in comparison.
+         * @return Diff between tree and index.
+         */
+        static Diff tree_to_index(const Repository& repo, const Tree& oldTree, const Index& index, const git_diff_options* opts);
+
+        /**
+         * Return the diff delta for an entry in the diff list.
+         *
+         * The delta is owned by the diff and will be freed with it.
+         *
+         * @param idx Index into diff list.
+         * @return The delta at that index, or nullptr if the index is out of range.
+         */
+        [[nodiscard]] const git_diff_delta *get_delta(size_t idx) const;
     };
 }
\ No newline at end of file
@@ -70,6 +70,40 @@ namespace git {
          */
         void add_all(const StrArray& pathspec, unsigned int flags, git_index_matched_path_cb callback);
 
+        /**
+         * Add or update an index entry from an in-memory struct
+         *
+         * If a previous index entry exists that has the same path and stage
+         * as the given 'source_entry', it will be replaced. Otherwise, the
+         * 'source_entry' will be added.
+         *
+         * A full copy (including the 'path' string) of the given
+         * 'source_entry' will be inserted on the index.
+         *
+         * @param entry New entry object.
+         */
+        void add(const git_index_entry& entry);
+
+        /**
+         * Remove an entry from the index
+         *
+         * @param path Path to search.
+         * @param stage Stage to search.
+         */
+        void remove(const string& path, int stage);
+
+        /**
+         * Get a pointer to one of the entries in the index
+         *
+         * The entry is not modifiable and should not be freed. Because the
+         * pointer is only valid until the index is modified, it should be
+         * copied if it will be used after further changes to the index.
+         *
+         * @param n The position of the entry.
+         * @return A pointer to the entry; nullptr if out of bounds.
+         */
+        [[nodiscard]] const git_index_entry *get_byindex(size_t n) const;
+
         /**
          * Write the index as a tree
          *
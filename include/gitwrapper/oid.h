@@ -29,3 +29,14 @@ namespace git {
         [[nodiscard]] string str() const;
     };
 }
+
+namespace std {
+    /**
+     * Hashes OIDs so they can be used as keys in unordered containers.
+     * OIDs are already uniformly distributed hashes, so their leading bytes are used directly.
+     */
+    template<>
+    struct hash<git::OID> {
+        size_t operator()(const git::OID& oid) const noexcept;
+    };
+}
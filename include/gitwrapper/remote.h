@@ -44,5 +44,78 @@ namespace git {
          * @param opts Options to use for this push.
          */
         void push(StrArray refspecs, git_push_options opts) const;
+
+        /**
+         * Open a connection to a remote
+         *
+         * The transport is selected based on the URL. The direction argument
+         * is due to a limitation of the git protocol (over TCP or SSH) which
+         * starts up a specific binary which can only do the one or the other.
+         *
+         * @param direction GIT_DIRECTION_FETCH if you want to fetch or
+         * GIT_DIRECTION_PUSH if you want to push.
+         * @param callbacks The callbacks to use for this connection.
+         */
+        void connect(git_direction direction, const git_remote_callbacks& callbacks) const;
+
+        /**
+         * Download and index the packfile
+         *
+         * Connect to the remote if it hasn't been done yet, negotiate with the
+         * remote git which objects are missing, download and index the packfile.
+         *
+         * The .idx file will be created and both it and the packfile with be
+         * renamed to their final name.
+         *
+         * @param refspecs The refspecs to use for this negotiation and download.
+         * Use an empty array to use the base refspecs.
+         * @param opts The options to use for this fetch.
+         */
+        void download(const StrArray& refspecs, const git_fetch_options& opts) const;
+
+        /**
+         * Update the tips to the new state
+         *
+         * @param callbacks The callback structure to use.
+         * @param updateFetchhead Whether to write to FETCH_HEAD.
+         * @param downloadTags What the behaviour for downloading tags is for this fetch.
+         * This is ignored for push.
+         */
+        void update_tips(const git_remote_callbacks& callbacks, bool updateFetchhead,
+                git_remote_autotag_option_t downloadTags) const;
+
+        /**
+         * Prune tracking refs that are no longer present on remote
+         *
+         * @param callbacks Callbacks to use for this prune.
+         */
+        void prune(const git_remote_callbacks& callbacks) const;
+
+        /**
+         * Get the remote repository's reference advertisement list
+         *
+         * Get the list of references with which the server responds to a new
+         * connection.
+         *
+         * The remote must be connected.
+         *
+         * @return Map from the name of each advertised reference to its target.
+         */
+        [[nodiscard]] map<string, OID> ls() const;
+
+        /**
+         * Get the name of the remote's default branch, which its HEAD points to
+         *
+         * The remote must be connected.
+         *
+         * @return The full name of the default branch, e.g. "refs/heads/master".
+         * @throws GitException If the remote has no default branch, such as when it is empty.
+         */
+        [[nodiscard]] string default_branch() const;
+
+        /**
+         * Close the connection to the remote
+         */
+        void disconnect() const;
     };
 }
\ No newline at end of file
@@ -26,6 +26,8 @@ namespace git {
     private:
         explicit Repository(git_repository *repo) : repo(repo, git_repository_free) {}
 
+        explicit Repository(shared_ptr<git_repository> repo) : repo(move(repo)) {}
+
         shared_ptr<git_repository> repo;
 
     public:
@@ -35,6 +37,15 @@ namespace git {
             return repo;
         }
 
+        /**
+         * Wrap a repository owned by libgit2, such as one passed to a callback, without taking ownership of it.
+         * The wrapper must not outlive the repository.
+         *
+         * @param repo The repository to wrap.
+         * @return The wrapped repository.
+         */
+        [[nodiscard]] static Repository borrow(git_repository *repo);
+
         /**
          * Creates a new Git repository in the given folder.
          *
@@ -90,6 +101,44 @@ namespace git {
          */
         [[nodiscard]] string path() const;
 
+        /**
+         * Gets the path of the working directory of the repository.
+         *
+         * @return Working directory path, ending with `/`, or an empty string if the repository is bare.
+         */
+        [[nodiscard]] string workdir() const;
+
+        /**
+         * Test if the ignore rules apply to a given path.
+         *
+         * This function checks the ignore rules to see if they would apply to the
+         * given file. This indicates if the file would be ignored regardless of
+         * whether the file is already in the index or committed to the repository.
+         *
+         * @param path The file to check ignores for, relative to the repo's workdir.
+         * @return True if the path is ignored.
+         */
+        [[nodiscard]] bool is_path_ignored(const string& path) const;
+
+        /**
+         * Read a file from the working folder of a repository
+         * and write it to the Object Database as a loose blob,
+         * applying any filters, such as line ending conversion, configured for its path.
+         *
+         * @param path File path relative to the repository's working directory.
+         * @return The OID of the written blob.
+         */
+        [[nodiscard]] OID create_blob_from_workdir(const string& path) const;
+
+        /**
+         * Calculate the blob OID of a file in the working folder of a repository without writing it
+         * to the Object Database, applying any filters configured for its path.
+         *
+         * @param path File path relative to the repository's working directory.
+         * @return The OID the file's blob would have.
+         */
+        [[nodiscard]] OID hashfile(const string& path) const;
+
         /**
          * Create a new action signature with default user and now timestamp.
          *
@@ -131,6 +180,14 @@ namespace git {
          */
         [[nodiscard]] Branch lookup_reference(const string& name) const;
 
+        /**
+         * Check whether a reference exists in a repository, by looking it up with `git_reference_lookup()`.
+         *
+         * @param name The long name for the reference (e.g. HEAD, refs/heads/master, refs/tags/v0.1.0, ...).
+         * @return True if the reference exists, or false if it wasn't found.
+         */
+        [[nodiscard]] bool reference_exists(const string& name) const;
+
         /**
          * Lookup a branch by its name in a repository.
          *
@@ -156,6 +213,20 @@ namespace git {
          */
         [[nodiscard]] Commit lookup_commit(const OID& oid) const;
         [[nodiscard]] AnnotatedCommit lookup_annotated_commit(const OID& id) const;
+
+        /**
+         * Create new commit in the repository.
+         *
+         * @param updateRef Name of the reference to update to point at the new commit,
+         *        or an empty string to not update any reference.
+         * @param author Signature with author and author time of commit.
+         * @param committer Signature with committer and commit time of commit.
+         * @param messageEncoding The encoding for the message in the commit.
+         * @param message Full message for this commit.
+         * @param tree The tree for the commit.
+         * @param parents The parents of the commit.
+         * @return The OID of the newly created commit.
+         */
         [[nodiscard]] OID create_commit(const string& updateRef, const git_signature &author, const git_signature &committer,
                           const string& messageEncoding, const string& message, const Tree& tree,
                           vector<Commit> parents) const;
@@ -413,6 +484,28 @@ namespace git {
          */
         [[nodiscard]] Remote remote_create(string name, string url) const;
 
+        /**
+         * Add a remote with the provided fetch refspec (or default if empty) to the repository's configuration.
+         *
+         * @param name The remote's name.
+         * @param url The remote's url.
+         * @param fetch The remote fetch value.
+         * @return The resulting remote.
+         */
+        [[nodiscard]] Remote remote_create_with_fetchspec(string name, string url, string fetch) const;
+
+        /**
+         * Add a fetch refspec to the remote's configuration.
+         *
+         * Add the given refspec to the fetch list in the configuration. No loaded remote instances will be affected,
+         * so the remote is looked up again and returned.
+         *
+         * @param remote Name of the remote to change.
+         * @param refspec The new fetch refspec.
+         * @return The remote, including the new refspec.
+         */
+        [[nodiscard]] Remote remote_add_fetch(string remote, string refspec) const;
+
         /**
          * Set the remote's url in the configuration
          *
@@ -0,0 +1,86 @@
+/*
+ * Defines a wrapper for the git_transaction type.
+ */
+
+#pragma once
+
+namespace git {
+    /**
+     * A transaction over the references of a repository. References are locked as they are added
+     * to the transaction, and all the queued updates are written when it is committed.
+     * Any locks still held are released when the transaction is freed.
+     */
+    class Transaction {
+    private:
+        shared_ptr<git_transaction> tx;
+
+    public:
+        explicit Transaction(git_transaction *tx) : tx(tx, git_transaction_free) {}
+
+        Transaction() = default;
+
+        [[nodiscard]] shared_ptr<git_transaction> ptr() const {
+            return tx;
+        }
+
+        /**
+         * Create a new transaction object
+         *
+         * This does not lock anything, but sets up the transaction object to
+         * know from which repository to lock.
+         *
+         * @param repo Repository in which to lock
+         * @return The created transaction
+         */
+        static Transaction create(const Repository& repo);
+
+        /**
+         * Lock a reference
+         *
+         * Lock the specified reference. This is the first step to updating a
+         * reference.
+         *
+         * @param refname The reference to lock
+         */
+        void lock_ref(const string& refname) const;
+
+        /**
+         * Set the target of a reference
+         *
+         * Set the target of the specified reference. This reference must be
+         * locked.
+         *
+         * @param refname Reference to update
+         * @param target Target to set the reference to
+         * @param msg Message to use in the reflog
+         */
+        void set_target(const string& refname, const OID& target, const string& msg) const;
+
+        /**
+         * Set the target of a reference
+         *
+         * Set the target of the specified reference. This reference must be
+         * locked.
+         *
+         * @param refname Reference to update
+         * @param target Target to set the reference to
+         * @param msg Message to use in the reflog
+         */
+        void set_symbolic_target(const string& refname, const string& target, const string& msg) const;
+
+        /**
+         * Remove a reference
+         *
+         * @param refname The reference to remove
+         */
+        void remove(const string& refname) const;
+
+        /**
+         * Commit the changes from the transaction
+         *
+         * Perform the changes that have been queued. The updates will be made
+         * one by one, and the first failure will stop the processing.
+         */
+        void commit() const;
+    };
+}
@@ -87,6 +87,16 @@ vector<string> split_args(const string& command);
  */
 void print_options(const vector<string>& options);
 
+/**
+ * Parse the value of an option giving a number of seconds.
+ * @param args The arguments containing the option.
+ * @param name Name of the option.
+ * @param defaultValue Value to use if the option isn't present.
+ * @return The number of seconds.
+ * @throws InvalidValueException If the value isn't a positive integer.
+ */
+unsigned int parse_seconds_option(const Arguments &args, const string& name, unsigned int defaultValue);
+
 /**
  * Print string right-padded to given length.
  * @param str String to print out.
@@ -110,6 +120,70 @@ string read_all(const string& path);
  */
 void write_all(const string& text, const string& path);
 
+// Number of milliseconds to wait for another process to release a lock file before giving up.
+#define FILE_LOCK_TIMEOUT_MILLISECONDS 5000
+
+/**
+ * An exclusive lock on a file, held by creating path + ".lock" like Git does for refs.
+ * New contents are written to the lock file and renamed over the original when committed,
+ * so readers never see a partially written file. Take the lock before reading the file
+ * to update it, so that no other process can change it in between.
+ * If the lock is destroyed without being committed, the file is left unchanged.
+ */
+class FileLock {
+    string path;
+    int fd = -1;
+
+public:
+    /**
+     * Take the lock, waiting up to FILE_LOCK_TIMEOUT_MILLISECONDS if another process holds it.
+     * @param path Path of the file to lock.
+     * @throws MetroException If the lock is still held by another process, or can't be created.
+     */
+    explicit FileLock(const string& path);
+
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+
+    /**
+     * Release the lock if it hasn't been committed.
+     */
+    ~FileLock();
+
+    /**
+     * Replace the contents of the file, syncing them to disk before renaming the lock file over the original.
+     * This releases the lock.
+     * @param text Text to write to the file.
+     * @throws MetroException If the file couldn't be written.
+     */
+    void commit(const string& text);
+};
+
+/**
+ * An exclusive advisory lock on a file, held for as long as the object exists.
+ * Unlike FileLock this waits for as long as another process holds the lock,
+ * and the lock is released automatically if the holding process dies, so the file can be left in place.
+ */
+class AdvisoryLock {
+    int fd = -1;
+
+public:
+    /**
+     * Take the lock, creating the file if needed and waiting until no other process holds it.
+     * @param path Path of the file to lock.
+     * @throws MetroException If the file can't be opened or locked.
+     */
+    explicit AdvisoryLock(const string& path);
+
+    AdvisoryLock(const AdvisoryLock&) = delete;
+    AdvisoryLock& operator=(const AdvisoryLock&) = delete;
+
+    /**
+     * Release the lock.
+     */
+    ~AdvisoryLock();
+};
+
 /**
  * Converts a git::Time object to a corresponding string format.
  * @param time The time as a git::Time object.
@@ -186,6 +260,21 @@ void disable_ansi();
  */
 string get_env(const string& name);
 
+/**
+ * Check whether standard input is a terminal, so that the user can be prompted for input.
+ * Background processes have no terminal, so must not wait for input.
+ *
+ * @return True if standard input is a terminal.
+ */
+bool stdin_is_terminal();
+
+/**
+ * Raise the soft limit on open files to the hard limit, so that large ref transactions can hold
+ * a lock file open for every ref. Keeps the old limit if it can't be raised.
+ * Does nothing on Windows, which has no such limit.
+ */
+void raise_open_file_limit();
+
 /**
  * Replace all instances of a string with another
  * string, returning the result.
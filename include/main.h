@@ -23,6 +23,8 @@ Command *allCommands[] = {
         &absorbCmd,
         &resolve,
         &syncCmd,
+        &prefetchCmd,
+        &fsmonitorCmd,
         &listCmd,
         &sinkCmd,
         &renameCmd,
@@ -80,6 +80,7 @@ namespace metro {
     struct CredentialPayload {
         CredentialStore *credStore;
         const Repository *repo;
+        bool interactive = true;    // Whether the user can be asked for credentials
     };
 
     // Tuple of URL and Credential Store
@@ -96,6 +97,9 @@ namespace metro {
      *
      * If the credentials pointer in the payload is already non-null it is returned
      * instead of acquiring new credentials, allowing credential reuse.
+     *
+     * If the payload is not interactive, only credential helpers and default credentials are used,
+     * and authentication fails rather than retrying with other credentials.
      */
     int acquire_credentials(git_cred **cred, const char *url, const char *username_from_url,
             unsigned int allowed_types, void *payload);
@@ -0,0 +1,68 @@
+/*
+ * A filesystem monitor, which records the paths that change in the working directory
+ * so that Metro only needs to check those paths rather than scanning everything.
+ */
+
+#pragma once
+
+// Name of the journal file within the git directory, which the monitor records changed paths in.
+#define FSMONITOR_JOURNAL_FILE "metro-fsmonitor"
+// Header line at the start of the journal file, which changes whenever its format does.
+#define FSMONITOR_JOURNAL_HEADER "# metro fsmonitor v1\n"
+// Name of the file within the git directory holding the monitor token from when the index last matched the working directory.
+#define FSMONITOR_TOKEN_FILE "metro-fsmonitor-token"
+// Prefix of the cookie files created in the git directory to check that the monitor has caught up.
+#define FSMONITOR_COOKIE_PREFIX "metro-fsmonitor-cookie-"
+// Number of milliseconds to wait for the monitor to catch up before falling back to a full scan.
+#define FSMONITOR_COOKIE_TIMEOUT_MILLISECONDS 1000
+// Size in bytes beyond which the monitor starts a new journal, rather than letting it grow forever.
+#define FSMONITOR_JOURNAL_LIMIT (16 * 1024 * 1024)
+// Name of the log file within the git directory written by a monitor running in the background.
+#define FSMONITOR_LOG_FILE "metro-fsmonitor.log"
+
+namespace metro {
+    // The changes reported by the filesystem monitor since the index last matched the working directory.
+    struct FsmonitorQuery {
+        string token;                   // The monitor's current position, or empty if no monitor is running.
+        string ignores;                 // The ignore stamp when the monitor was queried.
+        bool valid = false;             // Whether paths holds every change since the index last matched the working directory.
+        unordered_set<string> paths;    // Changed paths relative to the working directory; directories end with a '/'.
+    };
+
+    /**
+     * Watches the working directory with inotify until the process is killed, recording every path
+     * that changes in the journal at .git/metro-fsmonitor.
+     *
+     * Each time the monitor starts, or loses events because its queue overflowed, it starts a new
+     * journal with a new generation, so that clients fall back to a full scan.
+     * Only supported on Linux.
+     *
+     * @param repo The repository to monitor.
+     * @throws MetroException If a monitor is already running for the repository.
+     */
+    [[noreturn]] void run_fsmonitor(const Repository& repo);
+
+    /**
+     * Ask the filesystem monitor for the paths that have changed since the index last matched the working directory,
+     * as recorded by save_fsmonitor_token(). Before reading the journal, this waits for the monitor to catch up
+     * with any changes made before the call.
+     *
+     * The result is only valid if a monitor is running, has been running since the token was saved without
+     * losing events, and neither the index nor the global ignore rules have changed since.
+     * Otherwise a full scan is needed.
+     *
+     * @param repo The repository.
+     * @return The changed paths.
+     */
+    FsmonitorQuery query_fsmonitor(const Repository& repo);
+
+    /**
+     * Record that the index now matches the working directory as of a query, so that the next query only
+     * reports changes made since. Must be called right after writing the index.
+     * Does nothing if no monitor was running when queried.
+     *
+     * @param repo The repository.
+     * @param query The query made before the working directory was scanned.
+     */
+    void save_fsmonitor_token(const Repository& repo, const FsmonitorQuery& query);
+}
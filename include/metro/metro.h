@@ -4,9 +4,14 @@
 
 #pragma once
 
+// Name of the file within the git directory caching the counts of uncommitted changes printed by metro info.
+#define STATUS_CACHE_FILE "metro-status"
+
 namespace metro {
     using namespace git;
 
+    struct FsmonitorQuery;
+
     /**
      * Tests if the repo is currently merging.
      *
@@ -40,6 +45,36 @@ namespace metro {
      */
     Diff current_changes(const Repository& repo);
 
+    // Numbers of files of each kind of change in the working directory since the last commit.
+    struct ChangeCounts {
+        size_t added = 0;       // Files added since the last commit, including untracked files
+        size_t deleted = 0;     // Files deleted since the last commit
+        size_t modified = 0;    // Files whose content or mode has changed
+        size_t renamed = 0;     // Files moved to a new path
+        size_t copied = 0;      // New files copied from an existing file
+    };
+
+    /**
+     * Finds differences between head and the working directory, without adding anything to the index
+     * or writing to the object database. Untracked files that aren't ignored are included, as they would
+     * be added by a commit.
+     *
+     * @param repo The repo to use for the HEAD.
+     * @param query The result of query_fsmonitor().
+     * @return The diff created between HEAD and the working directory.
+     */
+    Diff worktree_changes(const Repository& repo, const FsmonitorQuery& query);
+
+    /**
+     * Counts the changes in the working directory since the last commit, without writing the index.
+     * The counts are cached at .git/metro-status, keyed on HEAD and the signature from status_signature(),
+     * so they are only recounted once something has changed.
+     *
+     * @param repo The repository.
+     * @return The counts of each kind of change, with untracked files counted as added.
+     */
+    ChangeCounts count_changes(const Repository& repo);
+
     /**
      * Commit all files in the repo directory (excluding those in .gitignore) to updateRef.
      *
@@ -86,6 +121,18 @@ namespace metro {
      */
     Index add_all(const Repository& repo);
 
+    /**
+     * Add all files from the working directory to the staging area, only checking the paths reported
+     * by the filesystem monitor if the query is valid.
+     * If the working directory had to be added by libgit2, the query's token is cleared
+     * so that save_fsmonitor_token() doesn't save it.
+     *
+     * @param repo Repository to add files to.
+     * @param query The result of query_fsmonitor(), made before calling this.
+     * @return The resulting index of adding the new files.
+     */
+    Index add_all(const Repository& repo, FsmonitorQuery& query);
+
     /**
      * Create a new empty git repository in the specified directory,
      * with an initial commit.
@@ -195,6 +242,27 @@ namespace metro {
      */
     void checkout(const Repository& repo, const Commit& commit);
 
+    /**
+     * Updates the working directory and index from one tree to another without moving head,
+     * only touching the paths that differ between the two trees.
+     * The working directory is assumed to already match `from`; files that are the same in both
+     * trees are never read or written, so they keep their index stat data.
+     * Doesn't change current branch ref.
+     *
+     * @param repo Repo to checkout in.
+     * @param from Tree the working directory currently matches. An empty Tree represents the empty tree.
+     * @param to Tree to update the working directory to. An empty Tree represents the empty tree.
+     */
+    void checkout(const Repository& repo, const Tree& from, const Tree& to);
+
+    /**
+     * Gets the tree of the commit at HEAD.
+     *
+     * @param repo Repo to find the HEAD tree of.
+     * @return The HEAD tree, or an empty Tree if the current branch has no commits.
+     */
+    Tree head_tree(const Repository& repo);
+
     /**
      * Whether the user has changes currently not committed.
      *
@@ -211,6 +279,16 @@ namespace metro {
      */
     [[nodiscard]] vector<StandaloneConflict> get_conflicts(const Index& index);
 
+    /**
+     * If the working directory has changes since the last commit, or a merge has been started,
+     * commit these changes to a new #wip branch without removing them from the working directory.
+     * Any ongoing merge is ended, as it is stored in the WIP commit.
+     *
+     * @param repo Repo to commit WIP for current branch in.
+     * @return True if a WIP commit was made.
+     */
+    bool commit_wip(const Repository& repo);
+
     /**
      * If the working directory has changes since the last commit, or a merge has been started,
      * Save these changes in a WIP commit in a new #wip branch.
@@ -238,6 +316,7 @@ namespace metro {
 
     /**
      * Moves to the given branch, checking out changes and the HEAD of that branch.
+     * If the branch is implicit (see is_implicit_branch()), its local branch is created first.
      *
      * @param repo Repo to switch to branch within.
      * @param name Name of branch to switch to.
@@ -4,6 +4,53 @@
 
 #pragma once
 
+// Name of the sync cache file within the git directory.
+#define SYNC_CACHE_FILE "packed-synced"
+// First line of the sync cache file, identifying its format.
+#define SYNC_CACHE_HEADER "# metro packed-synced\n"
+// Directory within the git directory used by the old sync cache layout, with one file per branch.
+#define LEGACY_SYNC_CACHE_DIR "synced"
+// Name of the WIP hash memo file within the git directory.
+#define WIP_HASH_MEMO_FILE "wip-hashes"
+// Maximum number of entries kept in the WIP hash memo file.
+#define WIP_HASH_MEMO_LIMIT 4096
+// Minimum number of branches to plan per thread when planning a sync in parallel.
+#define SYNC_PLAN_BRANCHES_PER_THREAD 64
+// Number of refs locked at once by a RefBatch if the open file limit is unknown, as each lock holds a file open.
+#define REF_BATCH_LIMIT 256
+// Number of open files a RefBatch leaves free for other uses while it holds ref locks.
+#define REF_BATCH_RESERVED_FILES 256
+// Config variable naming the user's WIP namespace. When set, WIP branches are synced through that namespace.
+#define WIP_NAMESPACE_CONFIG "metro.wipNamespace"
+// Prefix of the per-user WIP namespaces on the remote, followed by the namespace name.
+#define REMOTE_WIP_PREFIX "refs/metro/wip/"
+// Prefix of the local remote-tracking refs for WIP branches fetched from the user's namespace.
+#define TRACKING_WIP_PREFIX "refs/metro/remotes/origin/wip/"
+// Name of the file within the git directory that a background sync writes its output to.
+#define SYNC_LOG_FILE "metro-sync.log"
+// Name of the file within the git directory that a background prefetch writes its output to.
+#define PREFETCH_LOG_FILE "metro-prefetch.log"
+// Default number of seconds between prefetches in the background.
+#define PREFETCH_DEFAULT_INTERVAL 300
+// Default longest number of seconds between prefetches, when backing off after failures.
+#define PREFETCH_DEFAULT_BACKOFF 3600
+// Config variable holding a pattern limiting the branches synced by default, as set by clone --branch.
+#define SYNC_ONLY_CONFIG "metro.syncOnly"
+// Multivar config variable naming the remotes that sync pushes to alongside origin.
+#define MIRROR_CONFIG "metro.mirror"
+// Name of the file within the git directory listing the mirrors that missed changes pushed to origin.
+#define MIRRORS_BEHIND_FILE "metro-mirrors-behind"
+// Config variable enabling squashing of local WIP commit chains when syncing.
+#define AUTO_SQUASH_WIP_CONFIG "metro.autoSquashWip"
+// Maximum number of commits in a WIP chain that will be squashed when syncing.
+#define WIP_CHAIN_LIMIT 64
+// Number of milliseconds between checks of the working directory when watching it.
+#define WATCH_POLL_MILLISECONDS 500
+// Default number of seconds the working directory must stay unchanged before a watching sync saves it.
+#define WATCH_DEFAULT_DEBOUNCE 2
+// Default number of seconds between full syncs when watching, to pick up remote changes.
+#define WATCH_DEFAULT_INTERVAL 30
+
 namespace metro {
     /*
      * Represents a base branch and it's corresponding WIP branch.
@@ -32,7 +79,7 @@ namespace metro {
          * @returns True if this DualTarget has no WIP branch or base is the first parent of head.
          * If this is not the case, then the dual branch is invalid and cannot be correctly synced.
          */
-        bool is_valid(const Repository& repo, map<OID, OID>& wipCommits) const;
+        bool is_valid(const Repository& repo, const unordered_map<OID, OID>& wipCommits) const;
     };
 
     // Collection of targets
@@ -42,11 +89,24 @@ namespace metro {
         DualTarget synced;
     };
 
+    // The local, remote and synced targets of each branch, indexed by base branch name.
+    typedef unordered_map<string, RefTargets> BranchTargets;
+
     /**
      * Enum representing types of sync that can be chosen to occur.
      */
     enum SyncType {PUSH, PULL, CONFLICT};
 
+    /**
+     * How a branch whose local and remote heads differ should be synced, as decided by the sync planner.
+     */
+    struct BranchPlan {
+        bool localValid = true;     // Whether the local target is valid for sync
+        bool remoteValid = true;    // Whether the remote target is valid for sync
+        SyncType type = PUSH;       // The type of sync needed, if both targets are valid
+        bool diverged = false;      // Whether both sides changed but one could still be fast-forwarded
+    };
+
     /**
      * Enum representing the direction of syncing chosen by the user.
      */
@@ -64,30 +124,210 @@ namespace metro {
      */
     OID wip_commit_hash(const Repository& repo, const OID& commit_oid);
 
+    /**
+     * Memo of WIP commit hashes (generated by wip_commit_hash()), stored between syncs at .git/wip-hashes
+     * so that each WIP commit only needs to be read and hashed once.
+     * WIP hashes are a pure function of the commit OID, so memoized hashes never go stale.
+     * The memo file is bounded in size, keeping the most recently used hashes.
+     */
+    class WipHashMemo {
+        struct Entry {
+            OID wipHash;        // WIP hash of the commit
+            size_t lastUse;     // Greater values were used more recently
+        };
+
+        const Repository *repo;
+
+        // Memoized entry for each commit OID.
+        unordered_map<OID, Entry> entries;
+        // The lastUse value given to the next entry used.
+        size_t clock = 0;
+        // Whether any hashes have been added since the memo was loaded.
+        bool changed = false;
+
+    public:
+        /**
+         * Loads the memo from the repo's git directory, starting empty if there is no memo file
+         * or it cannot be read.
+         *
+         * @param repo The repository, which must outlive the memo.
+         */
+        explicit WipHashMemo(const Repository& repo);
+
+        /**
+         * Gets the WIP hash of a commit, computing and memoizing it if it is not already known.
+         *
+         * @param commitOid The OID of the commit to be hashed.
+         * @return The WIP commit hash generated by wip_commit_hash().
+         */
+        OID hash(const OID& commitOid);
+
+        /**
+         * Writes the memo back to the git directory if any hashes have been added, keeping any hashes
+         * saved by other processes since it was loaded.
+         * If there are more than WIP_HASH_MEMO_LIMIT hashes, the least recently used are dropped.
+         * Nothing is saved if another process holds the memo's lock for more than FILE_LOCK_TIMEOUT_MILLISECONDS.
+         */
+        void save() const;
+    };
+
+    /**
+     * Collects the local branch changes made by a sync so they can be applied in a single ref transaction.
+     * Every ref is locked before any of them is written, so no other process can change them in between,
+     * but the refs are then written one at a time, so a crash part-way through the commit can still
+     * leave only some of them updated.
+     * Each lock holds a file open, so on POSIX systems a batch can lock all but REF_BATCH_RESERVED_FILES
+     * of the open files allowed after raise_open_file_limit(); elsewhere it can lock REF_BATCH_LIMIT refs.
+     * Batches larger than that are committed in several transactions, so their refs aren't all locked at once.
+     * Changes to the current branch that also require the working directory to be updated are
+     * carried out once the transaction has been committed.
+     */
+    class RefBatch {
+        const Repository *repo;
+        Transaction transaction;
+        // Maximum number of refs to lock in one transaction.
+        size_t limit;
+
+        // Refs that have already been locked in the transaction.
+        unordered_set<string> locked;
+        // Refs that are queued for removal. Removals are only added to the transaction when it is committed,
+        // as libgit2 would still remove a ref if it were given a new target after being queued for removal.
+        unordered_set<string> removed;
+        // Whether the working directory needs updating from oldTree to newTree after committing.
+        bool checkoutNeeded = false;
+        Tree oldTree;
+        Tree newTree;
+        // The current branch, if it needs to be deleted after committing.
+        string deleteAfter;
+        // HEAD as read by lock_head(), if HEAD must stay locked until the batch is committed.
+        optional<Head> heldHead;
+
+        /**
+         * Lock a ref in the transaction, unless it is already locked.
+         * If the limit on locked refs has been reached, the changes so far are committed first.
+         */
+        void lock(const string& refName);
+
+        /**
+         * Commit the ref changes made so far, including the queued removals, and start a new transaction.
+         */
+        void flush();
+
+    public:
+        /**
+         * @param repo The repository, which must outlive the batch.
+         */
+        explicit RefBatch(const Repository& repo);
+
+        /**
+         * Create or move a local branch. This cancels any removal of the branch queued earlier in the batch.
+         *
+         * @param branchName The branch to update.
+         * @param target The new target of the branch.
+         */
+        void set_target(const string& branchName, const OID& target);
+
+        /**
+         * Delete a local branch, along with its WIP branch if it is a base branch.
+         * The branch must not be the current branch. Deleting a branch that doesn't exist does nothing.
+         *
+         * @param branchName The branch to delete.
+         */
+        void remove(const string& branchName);
+
+        /**
+         * Create or move any ref, such as a remote-tracking ref.
+         * This cancels any removal of the ref queued earlier in the batch.
+         *
+         * @param refName The full name of the ref to update.
+         * @param target The new target of the ref.
+         */
+        void set_reference(const string& refName, const OID& target);
+
+        /**
+         * Delete any ref. Unlike remove(), WIP branches are not deleted along with their base branches.
+         * Deleting a ref that doesn't exist does nothing.
+         *
+         * @param refName The full name of the ref to delete.
+         */
+        void remove_reference(const string& refName);
+
+        /**
+         * Lock HEAD until the batch is committed, so that the current branch can't be switched
+         * while the batch is being built, then read it.
+         * If the batch is too large to commit at once, HEAD is locked again after each part is committed,
+         * and the batch fails if HEAD has moved in between.
+         *
+         * @return The current head of the repo.
+         */
+        Head lock_head();
+
+        /**
+         * Move HEAD to a local branch, which may be created by this batch.
+         *
+         * @param branchName The branch to move HEAD to.
+         */
+        void set_head(const string& branchName);
+
+        /**
+         * Update the working directory from one tree to another after committing, as by
+         * checkout(const Repository&, const Tree&, const Tree&).
+         *
+         * @param from Tree the working directory currently matches.
+         * @param to Tree to update the working directory to.
+         */
+        void checkout_after(const Tree& from, const Tree& to);
+
+        /**
+         * Delete the current branch after committing, switching to another branch as by delete_branch().
+         *
+         * @param branchName The current branch.
+         */
+        void delete_after(const string& branchName);
+
+        /**
+         * Commit all the ref changes, then update the working directory and delete the current branch if needed.
+         */
+        void commit();
+    };
+
     /**
      * Clones a repo from the given url to the given path.
      * @param url The url to clone.
      * @param path The path to clone to.
+     * @param branch If not empty, only this branch and its WIP branch are cloned, and later syncs are limited to it.
+     * @param cacheDir If not empty, a directory in which to keep a bare mirror of the remote.
+     *        The mirror is updated and the clone reads its objects through git alternates instead of downloading them.
      * @return The cloned repository.
      */
-    Repository clone(const string& url, const string& path);
+    Repository clone(const string& url, const string& path, const string& branch, const string& cacheDir);
 
     /**
     * Clones a repo from the given url to the given path.
     * @param url The url to clone.
     * @param path The path to clone to.
     * @param credentials The credentials used for cloning.
+    * @param branch If not empty, only this branch and its WIP branch are cloned, and later syncs are limited to it.
+    * @param cacheDir If not empty, a directory in which to keep a bare mirror of the remote.
+    *        The mirror is updated and the clone reads its objects through git alternates instead of downloading them.
     * @return The cloned repository.
     */
-    Repository clone(const string& url, const string& path, CredentialStore *credentials);
+    Repository clone(const string& url, const string& path, CredentialStore *credentials, const string& branch,
+                     const string& cacheDir);
 
     /**
      * Syncs the repo with the remote version.
      * @param repo The repo to sync.
      * @param direction The direction that can be synced.
      * @param force Whether to force sync.
+     * @param only Pattern limiting the sync to the base branches it matches, along with their WIP branches.
+     *        May contain one '*', which matches any sequence of characters. Empty to sync every branch,
+     *        or the branches matching metro.syncOnly if it is set.
+     * @param excludeCurrent Whether to leave out the current branch and its WIP branch.
+     *        The working directory is left untouched whenever the current branch is not synced.
+     * @throws UnsupportedOperationException If the pattern contains more than one '*'.
      */
-    void sync(const Repository& repo, SyncDirection direction, bool force);
+    void sync(const Repository& repo, SyncDirection direction, bool force, const string& only, bool excludeCurrent);
 
     /**
      * Syncs the repo with the remote version.
@@ -95,11 +335,95 @@ namespace metro {
      * @param credentials The credentials used for syncing.
      * @param direction The direction that can be synced.
      * @param force Whether to force sync.
+     * @param only Pattern limiting the sync to the base branches it matches, along with their WIP branches.
+     *        May contain one '*', which matches any sequence of characters. Empty to sync every branch,
+     *        or the branches matching metro.syncOnly if it is set.
+     * @param excludeCurrent Whether to leave out the current branch and its WIP branch.
+     *        The working directory is left untouched whenever the current branch is not synced.
+     * @param restSynced If not null, set to whether the branches a sync with excludeCurrent set would cover
+     *        were already synced, judging the remote by the refs it advertised to this sync.
+     * @throws UnsupportedOperationException If the pattern contains more than one '*'.
+     */
+    void sync(const Repository& repo, CredentialStore *credentials, SyncDirection direction, bool force,
+              const string& only, bool excludeCurrent, bool *restSynced);
+
+    /**
+     * Syncs every branch in two stages. The current branch and its WIP branch are synced first,
+     * so that the working directory is ready to work in as soon as possible, then the other branches are synced.
+     * The second stage is skipped if the first found that the other branches are already synced.
+     * If the head is detached, or the current branch doesn't match metro.syncOnly, every branch is synced at once.
+     * @param repo The repo to sync.
+     * @param direction The direction that can be synced.
+     * @param background Whether to leave the second stage to a background process, which writes its output
+     *        to SYNC_LOG_FILE in the git directory.
+     */
+    void staged_sync(const Repository& repo, SyncDirection direction, bool background);
+
+    /**
+     * Syncs continuously, until the process is killed.
+     * Every branch is synced at the start and then every interval, picking up remote changes.
+     * In between, the working directory is watched for changes. Once it has stopped changing for the debounce time,
+     * the current branch is synced, so a burst of edits is saved and pushed as a single WIP commit.
+     * Syncs that fail because the remote couldn't be reached are retried, waiting twice as long after each
+     * failure in a row, up to the interval. Any other error stops the watch.
+     * @param repo The repo to sync.
+     * @param direction The direction that can be synced.
+     * @param debounce Number of seconds the working directory must stay unchanged before its changes are synced.
+     * @param interval Number of seconds between syncs of every branch.
+     */
+    [[noreturn]] void watch_sync(const Repository& repo, SyncDirection direction, unsigned int debounce,
+                                 unsigned int interval);
+
+    /**
+     * Fetches every branch from the remote into the remote-tracking branches, along with the user's
+     * WIP namespace if one is set, so that a later sync doesn't need to fetch anything.
+     * The working directory and local branches are never touched.
+     * The user is never prompted for credentials, so only credential helpers and default credentials are used.
+     * @param repo The repo to fetch into.
+     */
+    void prefetch(const Repository& repo);
+
+    /**
+     * Prefetches repeatedly, until the process is killed.
+     * After each failed prefetch the wait before the next one is doubled, up to the given maximum.
+     * @param repo The repo to fetch into.
+     * @param interval Number of seconds to wait between successful prefetches.
+     * @param backoff Longest number of seconds to wait between prefetches after failures.
+     */
+    [[noreturn]] void prefetch_repeatedly(const Repository& repo, unsigned int interval, unsigned int backoff);
+
+    /**
+     * Checks whether a branch is implicit: it exists on the remote, but has never been created locally or synced.
+     * Implicit branches are treated as local branches that match the remote. Syncing leaves them alone,
+     * and their local refs are only created once they are needed, for example when switching to them.
+     * The current branch is never implicit.
+     *
+     * @param repo The repository.
+     * @param name Name of the branch.
+     * @return True if the branch is implicit.
+     */
+    bool is_implicit_branch(const Repository& repo, const string& name);
+
+    /**
+     * Finds all the implicit branches in the repo, as described by is_implicit_branch().
+     *
+     * @param repo The repository.
+     * @return The names of the implicit branches, mapped to whether they have a WIP branch on the remote.
+     */
+    map<string, bool> implicit_branches(const Repository& repo);
+
+    /**
+     * Creates the local branch and WIP branch of an implicit branch from the remote,
+     * recording them in the sync cache so that they are no longer implicit.
+     *
+     * @param repo The repository.
+     * @param name Name of the implicit branch.
      */
-    void sync(const Repository& repo, CredentialStore *credentials, SyncDirection direction, bool force);
+    void create_implicit_branch(const Repository& repo, const string& name);
 
     /**
-     * Pulls all the repo branches assuming the remote is correct
+     * Pulls all the repo branches assuming the remote is correct.
+     * Implicit branches are left alone, so after cloning only the current branch is pulled.
      * @param repo The repo to force pull within.
      */
     void force_pull(const Repository& repo);
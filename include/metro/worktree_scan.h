@@ -0,0 +1,115 @@
+/*
+ * Scanning the working directory on several threads to bring the index up to date.
+ *
+ * Directory listings are remembered between scans in the untracked cache, at .git/metro-untracked.
+ * Directories whose mtime hasn't changed since they were cached are not read again, as adding, removing
+ * or renaming files within a directory always updates its mtime. A directory is always read again
+ * if its own or any parent's .gitignore has changed, and the whole cache is discarded if
+ * .git/info/exclude or core.excludesfile change.
+ */
+
+#pragma once
+
+// Minimum number of directories to list per thread when scanning the working directory in parallel.
+#define WORKTREE_SCAN_DIRECTORIES_PER_THREAD 16
+// Minimum number of files to stat or hash per thread when scanning the working directory in parallel.
+#define WORKTREE_SCAN_FILES_PER_THREAD 256
+
+// Name of the untracked cache file within the git directory.
+#define UNTRACKED_CACHE_FILE "metro-untracked"
+// Header line at the start of the untracked cache file, which changes whenever its format does.
+#define UNTRACKED_CACHE_HEADER "# metro untracked cache v1\n"
+
+namespace metro {
+    /**
+     * Add all files from the working directory to the index, with the same result as Index::add_all()
+     * with an empty pathspec, but walking directories, checking index entries and hashing files on several threads.
+     * Only files whose stat data doesn't match their index entries are hashed, and the index is updated
+     * in one batch once everything has been scanned. The index is not written to disk.
+     * Untracked files are found using the untracked cache.
+     *
+     * Repositories that can't be scanned exactly as libgit2 would, such as those with conflicts, submodules,
+     * nested repositories or case-insensitive paths, are left alone so that Index::add_all() can be used instead.
+     *
+     * @param repo The repository.
+     * @param index The repository's index, to update.
+     * @return True if the index was updated, or false if it was left alone.
+     */
+    bool scan_worktree(const Repository& repo, Index& index);
+
+    /**
+     * Bring the index up to date with only the given paths in the working directory, as reported by the
+     * filesystem monitor, assuming every other file still matches its index entry.
+     * A directory path, ending with a '/', covers all the files in and below it.
+     * The index is not written to disk.
+     *
+     * Repositories that scan_worktree() would leave alone are left alone here too, as are paths including
+     * a .gitignore file, since changed ignore rules could affect any file.
+     *
+     * @param repo The repository.
+     * @param index The repository's index, to update.
+     * @param paths The paths to check, relative to the working directory.
+     * @return True if the index was updated, or false if it was left alone.
+     */
+    bool scan_paths(const Repository& repo, Index& index, const unordered_set<string>& paths);
+
+    /**
+     * Check whether any of the given paths in the working directory differ from the index, assuming every
+     * other file still matches its index entry. Paths are treated the same as by scan_paths().
+     *
+     * @param repo The repository.
+     * @param index The repository's index.
+     * @param paths The paths to check, relative to the working directory.
+     * @param changed Output for whether any of the paths differ from the index.
+     * @return True if the paths were checked, or false if the repository was left alone.
+     */
+    bool paths_changed(const Repository& repo, const Index& index, const unordered_set<string>& paths, bool& changed);
+
+    /**
+     * Check whether the working directory differs from the index, stopping at the first difference found.
+     * The cheapest checks come first: the stat data of tracked files is compared with their index entries,
+     * then the untracked cache is used to look for untracked files, and only then are files whose
+     * stat data changed hashed to see whether their content did.
+     *
+     * As with scan_worktree(), repositories that can't be scanned exactly as libgit2 would are left alone.
+     *
+     * @param repo The repository.
+     * @param index The repository's index.
+     * @param changed Output for whether the working directory differs from the index.
+     * @return True if the working directory was checked, or false if the repository was left alone.
+     */
+    bool probe_worktree(const Repository& repo, const Index& index, bool& changed);
+
+    /**
+     * Get a signature of the index file's stat data, which changes whenever the index is written.
+     *
+     * @param repo The repository.
+     * @return The signature.
+     */
+    string index_signature(const Repository& repo);
+
+    /**
+     * Get a signature of the index and working directory, which changes whenever either of them could have.
+     * With a filesystem monitor running its token identifies the state of the working directory;
+     * otherwise the stat data of every tracked and untracked file is combined, using the untracked cache.
+     *
+     * As with scan_worktree(), repositories that can't be scanned exactly as libgit2 would are left alone.
+     *
+     * @param repo The repository.
+     * @param index The repository's index.
+     * @param query The result of query_fsmonitor().
+     * @param out Output for the signature.
+     * @return True if the signature was produced, or false if the repository was left alone
+     *         or a file was modified too recently for its stat data to be trusted.
+     */
+    bool status_signature(const Repository& repo, const Index& index, const FsmonitorQuery& query, string& out);
+
+    /**
+     * Get a stamp identifying the ignore rules that apply to the whole working directory,
+     * from .git/info/exclude and core.excludesfile, which changes whenever they do.
+     *
+     * @param repo The repository.
+     * @return The stamp.
+     */
+    string ignore_stamp(const Repository& repo);
+}
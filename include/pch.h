@@ -4,6 +4,8 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <iostream>
 #include <cstdio>
 #include <cstring>
@@ -20,12 +22,19 @@
 #include <iomanip>
 #include <sstream>
 #include <thread>
+#include <atomic>
+#include <optional>
+#include <limits>
 #include <csignal>
 #include <sys/stat.h>
 
 #ifdef _WIN32
 #include <windows.h>
 #include <direct.h>
+#include <io.h>
+#include <fcntl.h>
+
+#define fsync(fd) _commit(fd)
 #elif __unix__ || __APPLE__ || __MACH__
 #include <termios.h>
 #include <unistd.h>
@@ -36,9 +45,18 @@
 #include <fstream>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <dirent.h>
 #include <ctime>
 #include <signal.h>
 #include <cerrno>
+#include <sys/file.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif //__linux__
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#endif //__APPLE__
 
 #define _mkdir(path) mkdir(path, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH)
 
@@ -50,6 +68,7 @@ void _set_errno(int value) {
 #include "git2.h"
 #if (LIBGIT2_VER_MINOR < 28)
 #define git_error_last giterr_last
+#define git_error_set_str giterr_set_str
 #endif
 
 #include "filesystem.h"
@@ -73,6 +92,7 @@ using namespace std;
 #include "gitwrapper/strarray.h"
 #include "gitwrapper/diff.h"
 #include "gitwrapper/treebuilder.h"
+#include "gitwrapper/transaction.h"
 
 #include "metro/head.h"
 #include "metro/metro.h"
@@ -81,6 +101,8 @@ using namespace std;
 #include "metro/branch_descriptor.h"
 #include "metro/syncing.h"
 #include "metro/url_descriptor.h"
+#include "metro/worktree_scan.h"
+#include "metro/fsmonitor.h"
 
 #include "commands.h"
 #include "helper.h"
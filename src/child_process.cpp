@@ -95,6 +95,51 @@ Handle start_command(const string& cmd, const Pipe& childIn, const Pipe& childOu
     return procInfo.hProcess;
 }
 
+void start_background_command(const string& cmd, const string& logPath) {
+    SECURITY_ATTRIBUTES attributes;
+    attributes.nLength = sizeof(SECURITY_ATTRIBUTES);
+    attributes.bInheritHandle = true;
+    attributes.lpSecurityDescriptor = nullptr;
+
+    HANDLE log = CreateFile(logPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, &attributes,
+                            CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (log == INVALID_HANDLE_VALUE) {
+        throw MetroException("Couldn't create log file");
+    }
+
+    PROCESS_INFORMATION procInfo;
+    ZeroMemory(&procInfo, sizeof(PROCESS_INFORMATION));
+
+    STARTUPINFO startupInfo;
+    ZeroMemory(&startupInfo, sizeof(STARTUPINFO));
+    startupInfo.cb = sizeof(STARTUPINFO);
+    startupInfo.hStdError = log;
+    startupInfo.hStdOutput = log;
+    startupInfo.hStdInput = nullptr;
+    startupInfo.dwFlags = STARTF_USESTDHANDLES;
+
+    // Detach the process from the console so it keeps running after it is closed.
+    bool success = CreateProcess(nullptr, const_cast<char*>(cmd.c_str()), nullptr, nullptr, true,
+                                 DETACHED_PROCESS, nullptr, nullptr, &startupInfo, &procInfo);
+    CloseHandle(log);
+
+    if (!success) {
+        throw MetroException("Couldn't create process");
+    }
+
+    CloseHandle(procInfo.hThread);
+    CloseHandle(procInfo.hProcess);
+}
+
+string metro_command() {
+    char path[MAX_PATH];
+    DWORD length = GetModuleFileName(nullptr, path, MAX_PATH);
+    if (length == 0 || length == MAX_PATH) {
+        return "metro";
+    }
+    return "\"" + string(path, length) + "\"";
+}
+
 #elif __unix__ || __APPLE__ || __MACH__
 Pipe::Pipe(bool isOutput) {
     Handle handles[2];
@@ -140,6 +185,38 @@ void Pipe::flush(string& out) {
     out = outStream.str();
 }
 
+/**
+ * Replace the current process with the given command. Only returns if the command could not be executed.
+ * @param cmd Command reference to execute.
+ */
+void exec_command(const string& cmd) {
+    // Split the command string into separate arguments.
+    vector<string> args = split_args(cmd);
+
+    // Convert the list of arguments into a C string array.
+    // The strings themselves will be copied into a contiguous underlying array.
+    unsigned long totalChars = 0;
+    for (auto& arg : args) {
+        totalChars += arg.size() + 1;
+    }
+    char underlying[totalChars];
+
+    // A null-terminated array to store the string pointers.
+    char *argPtrs[args.size() + 1];
+    argPtrs[args.size()] = nullptr;
+
+    // Copy the strings into the underlying array,
+    // and set the pointers to the start of each string.
+    char *argStart = underlying;
+    for (int i = 0; i < args.size(); i++) {
+        strcpy(argStart, args[i].c_str());
+        argPtrs[i] = argStart;
+        argStart += args[i].size() + 1;
+    }
+
+    execvp(argPtrs[0], argPtrs);
+}
+
 Handle start_command(const string& cmd, const Pipe& childIn, const Pipe& childOut, const Pipe& childErr) {
     Handle pid = fork();
     if (pid < 0) {
@@ -163,37 +240,62 @@ Handle start_command(const string& cmd, const Pipe& childIn, const Pipe& childOu
         childOut.close();
         childErr.close();
 
-        // Split the command string into separate arguments.
-        vector<string> args = split_args(cmd);
+        exec_command(cmd);
+        // This only runs if the execution failed.
+        cerr << "Couldn't execute command" << endl;
+        exit(0);
+    }
 
-        // Convert the list of arguments into a C string array.
-        // The strings themselves will be copied into a contiguous underlying array.
-        unsigned long totalChars = 0;
-        for (auto& arg : args) {
-            totalChars += arg.size() + 1;
-        }
-        char underlying[totalChars];
-
-        // A null-terminated array to store the string pointers.
-        char *argPtrs[args.size() + 1];
-        argPtrs[args.size()] = nullptr;
-
-        // Copy the strings into the underlying array,
-        // and set the pointers to the start of each string.
-        char *argStart = underlying;
-        for (int i = 0; i < args.size(); i++) {
-            strcpy(argStart, args[i].c_str());
-            argPtrs[i] = argStart;
-            argStart += args[i].size() + 1;
+    return pid;
+}
+
+void start_background_command(const string& cmd, const string& logPath) {
+    Handle pid = fork();
+    if (pid < 0) {
+        throw MetroException("Couldn't fork process");
+    }
+
+    // Runs in the child process.
+    if (!pid) {
+        // Start a new session so the command isn't tied to the terminal, and survives it closing.
+        setsid();
+
+        Handle nullIn = open("/dev/null", O_RDONLY);
+        Handle log = open(logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (nullIn < 0 || log < 0 || dup2(nullIn, STDIN_FILENO) < 0
+                || dup2(log, STDOUT_FILENO) < 0 || dup2(log, STDERR_FILENO) < 0) {
+            exit(1);
         }
+        ::close(nullIn);
+        ::close(log);
 
-        execvp(argPtrs[0], argPtrs);
+        exec_command(cmd);
         // This only runs if the execution failed.
         cerr << "Couldn't execute command" << endl;
-        exit(0);
+        exit(1);
     }
+}
 
-    return pid;
+string metro_command() {
+    string path;
+#ifdef __APPLE__
+    char buffer[PATH_MAX];
+    uint32_t size = sizeof(buffer);
+    if (_NSGetExecutablePath(buffer, &size) == 0) {
+        path = buffer;
+    }
+#else
+    char buffer[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", buffer, sizeof(buffer));
+    if (length > 0 && length < (ssize_t) sizeof(buffer)) {
+        path = string(buffer, length);
+    }
+#endif //__APPLE__
+    // Quotes can't be escaped in a command, so fall back to the PATH rather than split the path wrongly.
+    if (path.empty() || path.find('"') != string::npos) {
+        return "metro";
+    }
+    return "\"" + path + "\"";
 }
 #endif
 
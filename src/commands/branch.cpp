@@ -28,7 +28,7 @@ Command branch {
             }
 
             git::Repository repo = git::Repository::open(".");
-            if (metro::branch_exists(repo, name)) {
+            if (metro::branch_exists(repo, name) || metro::is_implicit_branch(repo, name)) {
                 throw MetroException("Branch " + name + " already exists.");
             }
 
@@ -29,8 +29,24 @@ Command clone_repo {
             exit_config.cloning = true;
             exit_config.directory = name;
 
+            string branch;
+            if (args.options.find("branch") != args.options.end()) {
+                branch = args.options.at("branch");
+                if (branch.empty()) {
+                    throw MissingValueException("branch");
+                }
+            }
+
+            string cacheDir;
+            if (args.options.find("cache-dir") != args.options.end()) {
+                cacheDir = args.options.at("cache-dir");
+                if (cacheDir.empty()) {
+                    throw MissingValueException("cache-dir");
+                }
+            }
+
             cout << "Cloning " << url << " into " << name << endl;
-            metro::Repository repo = metro::clone(url, name);
+            metro::Repository repo = metro::clone(url, name, branch, cacheDir);
 
             if (!repo.head_detached()) {
                 metro::restore_wip(repo, true);
@@ -42,5 +58,6 @@ Command clone_repo {
         // printHelp
         [](const Arguments &args) {
             cout << "Usage: metro clone <url>" << endl;
+            print_options({"branch", "cache-dir", "help"});
         }
 };
\ No newline at end of file
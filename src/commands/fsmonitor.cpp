@@ -0,0 +1,34 @@
+/*
+ * Defines the Fsmonitor command.
+ */
+
+/**
+ * The fsmonitor command watches the working directory for changes, so that other commands
+ * only need to check the files that have changed.
+ */
+Command fsmonitorCmd {
+        "fsmonitor",
+        "Watch the working directory so changes are found faster",
+
+        // execute
+        [](const Arguments &args) {
+            if (!args.positionals.empty()) {
+                throw UnexpectedPositionalException(args.positionals[0]);
+            }
+
+            git::Repository repo = git::Repository::open(".");
+            if (args.options.find("background") != args.options.end()) {
+                start_background_command(metro_command() + " fsmonitor", repo.path() + FSMONITOR_LOG_FILE);
+                cout << "Monitoring the working directory in the background; see "
+                     << repo.path() + FSMONITOR_LOG_FILE << " for errors." << endl;
+            } else {
+                metro::run_fsmonitor(repo);
+            }
+        },
+
+        // printHelp
+        [](const Arguments &args) {
+            cout << "Usage: metro fsmonitor" << endl;
+            print_options({"background", "help"});
+        }
+};
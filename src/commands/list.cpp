@@ -156,6 +156,17 @@ Command listCmd{
                     }
                     cout << endl;
                 }
+
+                // Branches that have been fetched but not yet created locally are listed as if they were local.
+                for (const auto& implicit : metro::implicit_branches(repo)) {
+                    cout << "   " << implicit.first;
+                    if (implicit.second) {
+                        set_text_colour("--bi----f", hConsole);
+                        cout << " (WIP)";
+                        set_text_colour("rgb-----r", hConsole);
+                    }
+                    cout << endl;
+                }
             } else {
                 throw UnexpectedPositionalException(args.positionals[0]);
             }
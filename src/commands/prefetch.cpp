@@ -0,0 +1,42 @@
+/*
+ * Defines the Prefetch command.
+ */
+
+/**
+ * The prefetch command is used to fetch from the remote ahead of time, so that syncing is faster.
+ */
+Command prefetchCmd {
+        "prefetch",
+        "Fetch from remote ahead of syncing",
+
+        // execute
+        [](const Arguments &args) {
+            if (!args.positionals.empty()) {
+                throw UnexpectedPositionalException(args.positionals[0]);
+            }
+
+            git::Repository repo = git::Repository::open(".");
+            bool background = args.options.find("background") != args.options.end();
+            bool repeat = args.options.find("interval") != args.options.end();
+            unsigned int interval = parse_seconds_option(args, "interval", PREFETCH_DEFAULT_INTERVAL);
+            unsigned int backoff = parse_seconds_option(args, "backoff", PREFETCH_DEFAULT_BACKOFF);
+
+            if (background) {
+                start_background_command(metro_command() + " prefetch --interval " + to_string(interval)
+                                         + " --backoff " + to_string(backoff), repo.path() + PREFETCH_LOG_FILE);
+                cout << "Prefetching every " << interval << " seconds in the background; see "
+                     << repo.path() + PREFETCH_LOG_FILE << " for progress." << endl;
+            } else if (repeat) {
+                metro::prefetch_repeatedly(repo, interval, backoff);
+            } else {
+                metro::prefetch(repo);
+                cout << "Prefetched from origin." << endl;
+            }
+        },
+
+        // printHelp
+        [](const Arguments &args) {
+            cout << "Usage: metro prefetch" << endl;
+            print_options({"background", "backoff", "help", "interval"});
+        }
+};
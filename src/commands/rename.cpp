@@ -37,12 +37,15 @@ Command renameCmd {
 
             bool force = args.options.find("force") != args.options.end();
 
+            if (!metro::branch_exists(repo, from) && metro::is_implicit_branch(repo, from)) {
+                metro::create_implicit_branch(repo, from);
+            }
             if (!metro::branch_exists(repo, from) && !metro::is_on_branch(repo, from)) {
                 throw BranchNotFoundException(from);
             }
 
             // Ensure target branch + wip doesn't exist
-            if (metro::branch_exists(repo, to) && !force) throw UnsupportedOperationException("There is already a branch with that name.\nTo overwrite it, use 'metro rename --force'.");
+            if ((metro::branch_exists(repo, to) || metro::is_implicit_branch(repo, to)) && !force) throw UnsupportedOperationException("There is already a branch with that name.\nTo overwrite it, use 'metro rename --force'.");
             if (metro::branch_exists(repo, metro::to_wip(to)) && !force) throw UnsupportedOperationException("There is a WIP branch for the target branch name.\nTo overwrite it, use 'metro rename --force'.");
 
             if (metro::branch_exists(repo, from)) {
@@ -26,12 +26,47 @@ Command syncCmd {
             }
 
             git::Repository repo = git::Repository::open(".");
-            metro::sync(repo, direction, false);
+
+            // Only one way of choosing the branches to sync can be used at once.
+            const string scopeOptions[] = {"current", "only", "rest", "background", "watch"};
+            string scope;
+            for (const string& option : scopeOptions) {
+                if (args.options.find(option) != args.options.end()) {
+                    if (!scope.empty()) {
+                        throw InvalidOptionException(scope, option);
+                    }
+                    scope = option;
+                }
+            }
+
+            if (scope == "current" || scope == "rest") {
+                metro::Head head = metro::get_head(repo);
+                if (head.detached) {
+                    throw UnsupportedOperationException("Can't sync the current branch while the head is detached.");
+                }
+                if (scope == "current") {
+                    metro::sync(repo, direction, false, head.name, false);
+                } else {
+                    metro::sync(repo, direction, false, "", true);
+                }
+            } else if (scope == "only") {
+                string only = args.options.at("only");
+                if (only.empty()) {
+                    throw MissingValueException("only");
+                }
+                metro::sync(repo, direction, false, only, false);
+            } else if (scope == "watch") {
+                metro::watch_sync(repo, direction, parse_seconds_option(args, "debounce", WATCH_DEFAULT_DEBOUNCE),
+                                  parse_seconds_option(args, "interval", WATCH_DEFAULT_INTERVAL));
+            } else {
+                // Sync the current branch first so the user can get back to work sooner.
+                metro::staged_sync(repo, direction, scope == "background");
+            }
         },
 
         // printHelp
         [](const Arguments &args) {
             cout << "Usage: metro sync" << endl;
-            print_options({"help", "pull", "push"});
+            print_options({"background", "current", "debounce", "help", "interval", "only", "pull", "push", "rest", "watch"});
         }
 };
\ No newline at end of file
@@ -44,6 +44,11 @@ namespace git {
         return *sig;
     }
 
+    git_signature Commit::committer() const {
+        const git_signature* sig = git_commit_committer(commit.get());
+        return *sig;
+    }
+
     OID Commit::amend(const string& updateRef, const git_signature& author, const git_signature& committer,
               const string& messageEncoding, const string& message, const Tree& tree) const {
         git_oid oid;
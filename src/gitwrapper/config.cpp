@@ -13,6 +13,18 @@ namespace git {
         return string(buf.ptr);
     }
 
+    bool Config::get_bool(const string &name) {
+        int out;
+        int err = git_config_get_bool(&out, config.get(), name.c_str());
+        check_error(err);
+        return out;
+    }
+
+    void Config::set_string(const string &name, const string &value) {
+        int err = git_config_set_string(config.get(), name.c_str(), value.c_str());
+        check_error(err);
+    }
+
     void Config::get_multivar_foreach(const std::string & name, git_config_foreach_cb callback, void *payload) {
         int err = git_config_get_multivar_foreach(config.get(), name.c_str(), nullptr, callback, payload);
         check_error(err);
@@ -29,4 +29,15 @@ namespace git {
         check_error(err);
         return Diff(diff);
     }
+
+    Diff Diff::tree_to_index(const Repository& repo, const Tree& oldTree, const Index& index, const git_diff_options* opts) {
+        git_diff* diff;
+        int err = git_diff_tree_to_index(&diff, repo.ptr().get(), oldTree.ptr().get(), index.ptr().get(), opts);
+        check_error(err);
+        return Diff(diff);
+    }
+
+    const git_diff_delta *Diff::get_delta(size_t idx) const {
+        return git_diff_get_delta(diff.get(), idx);
+    }
 }
\ No newline at end of file
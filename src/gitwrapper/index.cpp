@@ -6,6 +6,20 @@ namespace git {
         check_error(err);
     }
 
+    void Index::add(const git_index_entry& entry) {
+        int err = git_index_add(index.get(), &entry);
+        check_error(err);
+    }
+
+    void Index::remove(const string& path, int stage) {
+        int err = git_index_remove(index.get(), path.c_str(), stage);
+        check_error(err);
+    }
+
+    const git_index_entry *Index::get_byindex(size_t n) const {
+        return git_index_get_byindex(index.get(), n);
+    }
+
     OID Index::write_tree() {
         git_oid oid;
         int err = git_index_write_tree(&oid, index.get());
@@ -23,4 +23,14 @@ namespace git {
     bool OID::operator<(const OID& other) const {
         return git_oid_cmp(&oid, &other.oid) < 0;
     }
-}
\ No newline at end of file
+}
+
+namespace std {
+    size_t hash<git::OID>::operator()(const git::OID& oid) const noexcept {
+        // Null OIDs compare equal regardless of their contents, so must hash equally.
+        if (oid.isNull) return 0;
+        size_t hash;
+        memcpy(&hash, oid.oid.id, sizeof(hash));
+        return hash;
+    }
+}
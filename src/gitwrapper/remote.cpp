@@ -8,4 +8,52 @@ namespace git {
         int err = git_remote_push(remote.get(), refspecs.ptr().get(), &opts);
         check_error(err);
     }
+
+    void Remote::connect(git_direction direction, const git_remote_callbacks& callbacks) const {
+        int err = git_remote_connect(remote.get(), direction, &callbacks, nullptr, nullptr);
+        check_error(err);
+    }
+
+    void Remote::download(const StrArray& refspecs, const git_fetch_options& opts) const {
+        int err = git_remote_download(remote.get(), refspecs.ptr().get(), &opts);
+        check_error(err);
+    }
+
+    void Remote::update_tips(const git_remote_callbacks& callbacks, bool updateFetchhead,
+            git_remote_autotag_option_t downloadTags) const {
+        int err = git_remote_update_tips(remote.get(), &callbacks, updateFetchhead, downloadTags, nullptr);
+        check_error(err);
+    }
+
+    void Remote::prune(const git_remote_callbacks& callbacks) const {
+        int err = git_remote_prune(remote.get(), &callbacks);
+        check_error(err);
+    }
+
+    map<string, OID> Remote::ls() const {
+        const git_remote_head **heads;
+        size_t count;
+        int err = git_remote_ls(&heads, &count, remote.get());
+        check_error(err);
+
+        map<string, OID> refs;
+        for (size_t i = 0; i < count; i++) {
+            refs.emplace(heads[i]->name, OID(heads[i]->oid));
+        }
+        return refs;
+    }
+
+    string Remote::default_branch() const {
+        git_buf buf{nullptr, 0, 0};
+        int err = git_remote_default_branch(&buf, remote.get());
+        check_error(err);
+        string name(buf.ptr);
+        git_buf_dispose(&buf);
+        return name;
+    }
+
+    void Remote::disconnect() const {
+        int err = git_remote_disconnect(remote.get());
+        check_error(err);
+    }
 }
\ No newline at end of file
@@ -1,4 +1,9 @@
 namespace git {
+    Repository Repository::borrow(git_repository *repo) {
+        // The no-op deleter leaves the repository to be freed by its owner.
+        return Repository(shared_ptr<git_repository>(repo, [](git_repository *) {}));
+    }
+
     Repository Repository::init(const string& path, bool isBare) {
         git_repository *gitRepo = nullptr;
         int err = git_repository_init(&gitRepo, path.c_str(), isBare);
@@ -42,6 +47,32 @@ namespace git {
         return string(git_repository_path(repo.get()));
     }
 
+    string Repository::workdir() const {
+        const char *workdir = git_repository_workdir(repo.get());
+        return workdir == nullptr ? "" : string(workdir);
+    }
+
+    bool Repository::is_path_ignored(const string& path) const {
+        int ignored;
+        int err = git_ignore_path_is_ignored(&ignored, repo.get(), path.c_str());
+        check_error(err);
+        return ignored;
+    }
+
+    OID Repository::create_blob_from_workdir(const string& path) const {
+        git_oid oid;
+        int err = git_blob_create_from_workdir(&oid, repo.get(), path.c_str());
+        check_error(err);
+        return OID(oid);
+    }
+
+    OID Repository::hashfile(const string& path) const {
+        git_oid oid;
+        int err = git_repository_hashfile(&oid, repo.get(), path.c_str(), GIT_OBJECT_BLOB, nullptr);
+        check_error(err);
+        return OID(oid);
+    }
+
     git_signature &Repository::default_signature() const {
         git_signature *sig;
         int err = git_signature_default(&sig, repo.get());
@@ -70,6 +101,17 @@ namespace git {
         return Branch(ref);
     }
 
+    bool Repository::reference_exists(const string& name) const {
+        git_reference *ref;
+        int err = git_reference_lookup(&ref, repo.get(), name.c_str());
+        if (err == GIT_ENOTFOUND) {
+            return false;
+        }
+        check_error(err);
+        git_reference_free(ref);
+        return true;
+    }
+
     Branch Repository::lookup_branch(const string &name, git_branch_t branchType) const {
         git_reference *branch;
         int err = git_branch_lookup(&branch, repo.get(), name.c_str(), branchType);
@@ -100,7 +142,8 @@ namespace git {
         }
 
         git_oid id;
-        int err = git_commit_create(&id, repo.get(), updateRef.c_str(), &author, &committer, messageEncoding.c_str(),
+        int err = git_commit_create(&id, repo.get(), updateRef.empty() ? nullptr : updateRef.c_str(),
+                                    &author, &committer, messageEncoding.c_str(),
                                     message.c_str(), tree.ptr().get(), parents.size(), parents_array);
         delete[] parents_array;
         check_error(err);
@@ -246,6 +289,21 @@ namespace git {
         return Remote(remote);
     }
 
+    Remote Repository::remote_create_with_fetchspec(string name, string url, string fetch) const {
+        git_remote *remote;
+        int err = git_remote_create_with_fetchspec(&remote, repo.get(), name.c_str(), url.c_str(), fetch.c_str());
+        check_error(err);
+
+        return Remote(remote);
+    }
+
+    Remote Repository::remote_add_fetch(string remote, string refspec) const {
+        int err = git_remote_add_fetch(repo.get(), remote.c_str(), refspec.c_str());
+        check_error(err);
+
+        return lookup_remote(remote);
+    }
+
     void Repository::remote_set_url(string remote, string url) const {
         int err = git_remote_set_url(repo.get(), remote.c_str(), url.c_str());
         check_error(err);
@@ -0,0 +1,33 @@
+namespace git {
+    Transaction Transaction::create(const Repository& repo) {
+        git_transaction *tx;
+        int err = git_transaction_new(&tx, repo.ptr().get());
+        check_error(err);
+        return Transaction(tx);
+    }
+
+    void Transaction::lock_ref(const string& refname) const {
+        int err = git_transaction_lock_ref(tx.get(), refname.c_str());
+        check_error(err);
+    }
+
+    void Transaction::set_target(const string& refname, const OID& target, const string& msg) const {
+        int err = git_transaction_set_target(tx.get(), refname.c_str(), &target.oid, nullptr, msg.c_str());
+        check_error(err);
+    }
+
+    void Transaction::set_symbolic_target(const string& refname, const string& target, const string& msg) const {
+        int err = git_transaction_set_symbolic_target(tx.get(), refname.c_str(), target.c_str(), nullptr, msg.c_str());
+        check_error(err);
+    }
+
+    void Transaction::remove(const string& refname) const {
+        int err = git_transaction_remove(tx.get(), refname.c_str());
+        check_error(err);
+    }
+
+    void Transaction::commit() const {
+        int err = git_transaction_commit(tx.get());
+        check_error(err);
+    }
+}
@@ -128,6 +128,18 @@ void print_options(const vector<string>& options) {
     }
 }
 
+unsigned int parse_seconds_option(const Arguments &args, const string& name, unsigned int defaultValue) {
+    auto option = args.options.find(name);
+    if (option == args.options.end()) {
+        return defaultValue;
+    }
+    int seconds = parse_pos_int(option->second);
+    if (seconds <= 0) {
+        throw InvalidValueException(name, option->second);
+    }
+    return seconds;
+}
+
 void print_padded(const string& str, size_t len) {
     cout << str;
     for (size_t i = 0; i < len - str.length(); i++) {
@@ -156,6 +168,85 @@ void write_all(const string& text, const string& path) {
     }
 }
 
+FileLock::FileLock(const string& path) : path(path) {
+    const string lockPath = path + ".lock";
+    for (int waited = 0;; waited += 10) {
+        fd = open(lockPath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd >= 0) {
+            return;
+        }
+        if (errno != EEXIST) {
+            throw MetroException("Error creating lock file: " + lockPath);
+        }
+        if (waited >= FILE_LOCK_TIMEOUT_MILLISECONDS) {
+            throw MetroException("Unable to create " + lockPath + ": File exists.\n"
+                                 "Another Metro process seems to be running in this repository; "
+                                 "if not, remove the file and try again.");
+        }
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+}
+
+FileLock::~FileLock() {
+    if (fd >= 0) {
+        close(fd);
+        error_code ec;
+        std::filesystem::remove(path + ".lock", ec);
+    }
+}
+
+void FileLock::commit(const string& text) {
+    const string lockPath = path + ".lock";
+    bool ok = true;
+    for (size_t written = 0; ok && written < text.size();) {
+        auto result = write(fd, text.data() + written, text.size() - written);
+        if (result >= 0) {
+            written += result;
+        } else {
+            ok = errno == EINTR;
+        }
+    }
+    // Make sure the contents are on disk before the rename, so a crash can't leave an empty file behind.
+    ok = fsync(fd) == 0 && ok;
+    ok = close(fd) == 0 && ok;
+    fd = -1;
+
+    error_code ec;
+    if (ok) {
+        std::filesystem::rename(lockPath, path, ec);
+    }
+    if (!ok || ec) {
+        std::filesystem::remove(lockPath, ec);
+        throw MetroException("Error writing to file: " + path);
+    }
+}
+
+AdvisoryLock::AdvisoryLock(const string& path) {
+    fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        throw MetroException("Error creating lock file: " + path);
+    }
+#ifdef _WIN32
+    OVERLAPPED overlapped = {};
+    const bool locked = LockFileEx((HANDLE) _get_osfhandle(fd), LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped);
+#else
+    int result;
+    do {
+        result = flock(fd, LOCK_EX);
+    } while (result != 0 && errno == EINTR);
+    const bool locked = result == 0;
+#endif //_WIN32
+    if (!locked) {
+        close(fd);
+        throw MetroException("Error locking file: " + path);
+    }
+}
+
+AdvisoryLock::~AdvisoryLock() {
+    // Closing the file releases the lock.
+    close(fd);
+}
+
 string time_to_string(git_time time) {
     char buf[80];
     struct tm ts = *localtime(reinterpret_cast<const time_t *>(&time.time));
@@ -505,6 +596,25 @@ string get_env(const string& name) {
 #endif
 }
 
+bool stdin_is_terminal() {
+#ifdef _WIN32
+    return _isatty(_fileno(stdin));
+#else
+    return isatty(STDIN_FILENO);
+#endif //_WIN32
+}
+
+void raise_open_file_limit() {
+#ifndef _WIN32
+    rlimit files{};
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur != files.rlim_max) {
+        files.rlim_cur = files.rlim_max;
+        // Some systems don't allow an unlimited soft limit, so just keep the old one if this fails.
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+#endif //_WIN32
+}
+
 string replace_all(string in, string find, string replace) {
     if (find.empty()) return in;
 
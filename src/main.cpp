@@ -176,6 +176,8 @@ int main(int argc, char *argv[]) {
 #endif //_WIN32
 
     git_libgit2_init();
+    // Syncs can lock thousands of refs at once, each holding a file open.
+    raise_open_file_limit();
 
     // Windows terminals don't all work out the box
 #ifdef _WIN32
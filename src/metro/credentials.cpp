@@ -86,7 +86,10 @@ namespace metro {
         CredentialStore *credStore = credPayload->credStore;
 
         // Check if credentials are already invalid
-        if (credStore->tried) {
+        if (credStore->tried && !credPayload->interactive) {
+            git_error_set_str(GIT_ERROR_CALLBACK, ("Authentication failed for " + string(url) + ".").c_str());
+            return GIT_EAUTH;
+        } else if (credStore->tried) {
             cout << "Invalid credentials, please try again or press Ctrl+C to abort" << endl;
             credStore->clear();
         }
@@ -96,7 +99,16 @@ namespace metro {
             credentials_from_helper(credPayload->repo, string(url), *credStore);
         }
 
-        if (credStore->empty()) {
+        if (credStore->empty() && !credPayload->interactive) {
+            // Default credentials don't need any input from the user.
+            if (allowed_types & GIT_CREDTYPE_DEFAULT) {
+                credStore->store_default();
+            } else {
+                git_error_set_str(GIT_ERROR_CALLBACK, ("No credentials found for " + string(url) + ". "
+                        "Set up a credential helper to authenticate without a terminal.").c_str());
+                return GIT_EAUTH;
+            }
+        } else if (credStore->empty()) {
             manual_credential_entry(credPayload->repo, url, username_from_url, allowed_types, *credStore);
         }
 
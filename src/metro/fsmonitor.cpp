@@ -0,0 +1,301 @@
+namespace metro {
+#ifdef __linux__
+    // Events that show a file or directory has been changed, added or removed.
+    const uint32_t FSMONITOR_EVENTS = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO
+                                      | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+    /**
+     * Watch a directory in the working directory and all of its subdirectories, apart from git directories.
+     * Directories that are already watched keep the same watch descriptor, with their path updated.
+     *
+     * @param inotify The inotify file descriptor.
+     * @param workdir The repository's working directory, ending with a '/'.
+     * @param dir The directory to watch relative to the working directory, ending with a '/',
+     *        or an empty string for the working directory itself.
+     * @param watches Map from watch descriptors to the directories they watch, to update.
+     */
+    void add_watches(int inotify, const string& workdir, const string& dir, unordered_map<int, string>& watches) {
+        int wd = inotify_add_watch(inotify, (workdir + dir).c_str(), FSMONITOR_EVENTS);
+        if (wd < 0) {
+            if (errno == ENOSPC) {
+                throw MetroException("Too many directories to watch; try raising fs.inotify.max_user_watches.");
+            }
+            // The directory was removed before it could be watched, which its parent's watch reports.
+            return;
+        }
+        watches[wd] = dir;
+
+        DIR *handle = opendir((workdir + dir).c_str());
+        if (handle == nullptr) {
+            return;
+        }
+        unique_ptr<DIR, int (*)(DIR *)> closer(handle, closedir);
+        for (dirent *ent = readdir(handle); ent != nullptr; ent = readdir(handle)) {
+            const string name = ent->d_name;
+            if (name == "." || name == ".." || name == ".git") {
+                continue;
+            }
+            struct stat st{};
+            if (ent->d_type == DT_DIR || (ent->d_type == DT_UNKNOWN
+                    && lstat((workdir + dir + name).c_str(), &st) == 0 && S_ISDIR(st.st_mode))) {
+                add_watches(inotify, workdir, dir + name + "/", watches);
+            }
+        }
+    }
+
+    /**
+     * Write all of a string to a file descriptor.
+     */
+    void write_fully(int fd, const string& text) {
+        for (size_t written = 0; written < text.size();) {
+            ssize_t result = write(fd, text.data() + written, text.size() - written);
+            if (result < 0 && errno != EINTR) {
+                throw MetroException("Failed to write filesystem monitor journal.");
+            }
+            written += max(result, (ssize_t) 0);
+        }
+    }
+
+    /**
+     * Empty the journal and start a new generation, so that clients can't use any earlier tokens.
+     *
+     * @param journal File descriptor of the journal, opened for appending.
+     * @return The size of the new journal.
+     */
+    size_t start_journal(int journal) {
+        static unsigned int count = 0;
+        // The generation has to differ from that of any earlier monitor too.
+        const string generation = to_string(time(nullptr)) + "-" + to_string(getpid()) + "-" + to_string(count++);
+        const string contents = FSMONITOR_JOURNAL_HEADER + generation + "\n";
+        if (ftruncate(journal, 0) != 0) {
+            throw MetroException("Failed to write filesystem monitor journal.");
+        }
+        write_fully(journal, contents);
+        return contents.size();
+    }
+
+    void run_fsmonitor(const Repository& repo) {
+        const string workdir = repo.workdir();
+        if (workdir.empty()) {
+            throw MetroException("Can't monitor a repository with no working directory.");
+        }
+
+        const string journalPath = repo.path() + FSMONITOR_JOURNAL_FILE;
+        int journal = open(journalPath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (journal < 0) {
+            throw MetroException("Failed to open filesystem monitor journal: " + journalPath);
+        }
+        // Clients check for this lock to see whether a monitor is running.
+        if (flock(journal, LOCK_EX | LOCK_NB) != 0) {
+            throw MetroException("A filesystem monitor is already running for this repository.");
+        }
+
+        int inotify = inotify_init1(IN_CLOEXEC);
+        if (inotify < 0) {
+            throw MetroException("Failed to start inotify.");
+        }
+        // Clients create cookie files in the git directory, which isn't otherwise watched.
+        const int gitWatch = inotify_add_watch(inotify, repo.path().c_str(), IN_CREATE | IN_ONLYDIR);
+        unordered_map<int, string> watches;
+        add_watches(inotify, workdir, "", watches);
+        size_t journalSize = start_journal(journal);
+        cout << "Monitoring " << workdir << endl;
+
+        alignas(inotify_event) char buffer[64 * 1024];
+        while (true) {
+            ssize_t length = read(inotify, buffer, sizeof(buffer));
+            if (length < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw MetroException("Failed to read filesystem events.");
+            }
+
+            string changes;
+            vector<string> cookies;
+            bool lostEvents = false;
+            const inotify_event *event;
+            for (char *ptr = buffer; ptr < buffer + length; ptr += sizeof(inotify_event) + event->len) {
+                event = (const inotify_event *) ptr;
+                if (event->mask & IN_Q_OVERFLOW) {
+                    lostEvents = true;
+                    continue;
+                }
+                if (event->wd == gitWatch) {
+                    if (event->len > 0 && strncmp(event->name, FSMONITOR_COOKIE_PREFIX, strlen(FSMONITOR_COOKIE_PREFIX)) == 0) {
+                        cookies.emplace_back(event->name);
+                    }
+                    continue;
+                }
+
+                auto watch = watches.find(event->wd);
+                if (watch == watches.end()) {
+                    continue;
+                }
+                if (event->mask & IN_IGNORED) {
+                    watches.erase(watch);
+                    continue;
+                }
+                // Events with no name are about the watched directory itself, which its parent reports.
+                if (event->len == 0 || (watch->second.empty() && strcmp(event->name, ".git") == 0)) {
+                    continue;
+                }
+
+                // A directory moved out of the working directory keeps its watch, so its events may have an old path.
+                // Clients find nothing at that path, which is harmless.
+                const string path = watch->second + event->name;
+                if (path.find('\n') != string::npos) {
+                    // The journal is line-based, so can't hold this path.
+                    lostEvents = true;
+                } else if (!(event->mask & IN_ISDIR)) {
+                    changes += path + "\n";
+                } else if (event->mask & (IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM)) {
+                    // Files may have been added to a new directory before it was watched,
+                    // so clients check everything below it.
+                    if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                        add_watches(inotify, workdir, path + "/", watches);
+                    }
+                    changes += path + "/\n";
+                }
+            }
+
+            if (lostEvents) {
+                // Clients must fall back to a full scan. Directories may have been added without being watched.
+                cout << "Lost filesystem events; starting a new journal." << endl;
+                add_watches(inotify, workdir, "", watches);
+                journalSize = start_journal(journal);
+            } else if (!changes.empty()) {
+                write_fully(journal, changes);
+                journalSize += changes.size();
+                if (journalSize > FSMONITOR_JOURNAL_LIMIT) {
+                    journalSize = start_journal(journal);
+                }
+            }
+
+            // Every change made before a cookie was created has now been written, so let the clients waiting on it go.
+            for (const string& cookie : cookies) {
+                unlink((repo.path() + cookie).c_str());
+            }
+        }
+    }
+
+    /**
+     * Wait for the filesystem monitor to record every change made before now.
+     * A cookie file is created in the git directory, which the monitor deletes once it has seen it;
+     * inotify reports events in order, so by then every earlier change has been written to the journal.
+     *
+     * @param repo The repository.
+     * @return True if the monitor caught up, or false if it timed out.
+     */
+    bool sync_with_fsmonitor(const Repository& repo) {
+        static atomic<unsigned int> count(0);
+        const string cookiePath = repo.path() + FSMONITOR_COOKIE_PREFIX + to_string(getpid()) + "-" + to_string(count++);
+        int cookie = open(cookiePath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (cookie < 0) {
+            return false;
+        }
+        close(cookie);
+
+        struct stat st{};
+        for (int waited = 0; waited < FSMONITOR_COOKIE_TIMEOUT_MILLISECONDS; waited++) {
+            if (lstat(cookiePath.c_str(), &st) != 0) {
+                return true;
+            }
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        unlink(cookiePath.c_str());
+        return false;
+    }
+
+    FsmonitorQuery query_fsmonitor(const Repository& repo) {
+        FsmonitorQuery query;
+        const string journalPath = repo.path() + FSMONITOR_JOURNAL_FILE;
+        int journal = open(journalPath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (journal < 0) {
+            return query;
+        }
+        // The monitor holds an exclusive lock on the journal for as long as it runs.
+        const bool running = flock(journal, LOCK_SH | LOCK_NB) != 0;
+        close(journal);
+        if (!running || !sync_with_fsmonitor(repo)) {
+            return query;
+        }
+
+        string contents;
+        try {
+            contents = read_all(journalPath);
+        } catch (MetroException&) {
+            return query;
+        }
+        // The monitor may be writing at the same time, so only read up to the last complete line.
+        const size_t headerEnd = strlen(FSMONITOR_JOURNAL_HEADER);
+        const size_t generationEnd = contents.find('\n', headerEnd);
+        if (contents.compare(0, headerEnd, FSMONITOR_JOURNAL_HEADER) != 0 || generationEnd == string::npos) {
+            return query;
+        }
+        const string generation = contents.substr(headerEnd, generationEnd - headerEnd);
+        const size_t end = contents.rfind('\n') + 1;
+        query.token = generation + ":" + to_string(end);
+        query.ignores = ignore_stamp(repo);
+
+        // The token file holds the token, followed by the index signature and ignore stamp when it was saved.
+        ifstream tokenFile(repo.path() + FSMONITOR_TOKEN_FILE);
+        string savedToken, savedIndex, savedIgnores;
+        if (!getline(tokenFile, savedToken) || !getline(tokenFile, savedIndex) || !getline(tokenFile, savedIgnores)
+                || savedIndex != index_signature(repo) || savedIgnores != query.ignores) {
+            return query;
+        }
+        const size_t colon = savedToken.rfind(':');
+        if (colon == string::npos || savedToken.substr(0, colon) != generation) {
+            return query;
+        }
+        size_t start;
+        try {
+            start = stoul(savedToken.substr(colon + 1));
+        } catch (exception&) {
+            return query;
+        }
+        if (start < generationEnd + 1 || start > end) {
+            return query;
+        }
+
+        while (start < end) {
+            const size_t lineEnd = contents.find('\n', start);
+            if (lineEnd > start) {
+                query.paths.insert(contents.substr(start, lineEnd - start));
+            }
+            start = lineEnd + 1;
+        }
+        query.valid = true;
+        return query;
+    }
+
+    void save_fsmonitor_token(const Repository& repo, const FsmonitorQuery& query) {
+        if (query.token.empty()) {
+            return;
+        }
+
+        // Write under a temporary name and rename, so a query running at the same time never reads a partial token.
+        const string path = repo.path() + FSMONITOR_TOKEN_FILE;
+        const string lockPath = path + ".lock";
+        write_all(query.token + "\n" + index_signature(repo) + "\n" + query.ignores + "\n", lockPath);
+
+        error_code ec;
+        std::filesystem::rename(lockPath, path, ec);
+        if (ec) {
+            std::filesystem::remove(lockPath, ec);
+            throw MetroException("Failed to write filesystem monitor token: " + path);
+        }
+    }
+#else
+    void run_fsmonitor(const Repository& repo) {
+        throw UnsupportedOperationException("The filesystem monitor is only supported on Linux.");
+    }
+
+    FsmonitorQuery query_fsmonitor(const Repository& repo) {
+        return FsmonitorQuery();
+    }
+
+    void save_fsmonitor_token(const Repository& repo, const FsmonitorQuery& query) {}
+#endif //__linux__
+}
@@ -17,30 +17,126 @@ namespace metro {
     }
 
     Tree working_tree(const Repository &repo) {
-        Index index = add_all(repo);
+        FsmonitorQuery query = query_fsmonitor(repo);
+        Index index = add_all(repo, query);
         // Write the files in the index into a tree that can be attached to the commit.
         OID oid = index.write_tree();
         Tree tree = repo.lookup_tree(oid);
         // Save the index to disk so that it stays in sync with the contents of the working directory.
         // If we don't do this removals of every file are left staged.
         index.write();
+        save_fsmonitor_token(repo, query);
 
         return tree;
     }
 
     Diff current_changes(const Repository &repo) {
-        Tree current = Tree();
-        try {
-            current = get_commit(repo, "HEAD").tree();
-        } catch (GitException &ex) {
-            // The current branch might have no commits, which is ok.
-        }
+        Tree current = head_tree(repo);
         git_diff_options opts = GIT_DIFF_OPTIONS_INIT;
+
+        // If the filesystem monitor shows that the working directory matches the index, it needn't be read.
+        FsmonitorQuery query = query_fsmonitor(repo);
+        Index index = repo.index();
+        bool changed;
+        if (query.valid && paths_changed(repo, index, query.paths, changed) && !changed) {
+            return Diff::tree_to_index(repo, current, index, &opts);
+        }
+
         Diff diff = Diff::tree_to_workdir_with_index(repo, current, &opts);
 
         return diff;
     }
 
+    Diff worktree_changes(const Repository &repo, const FsmonitorQuery &query) {
+        Tree current = head_tree(repo);
+        git_diff_options opts = GIT_DIFF_OPTIONS_INIT;
+
+        // If the working directory matches the index, it needn't be read.
+        Index index = repo.index();
+        bool changed;
+        if (((query.valid && paths_changed(repo, index, query.paths, changed)) || probe_worktree(repo, index, changed))
+                && !changed) {
+            return Diff::tree_to_index(repo, current, index, &opts);
+        }
+
+        opts.flags = GIT_DIFF_INCLUDE_UNTRACKED | GIT_DIFF_RECURSE_UNTRACKED_DIRS;
+        return Diff::tree_to_workdir_with_index(repo, current, &opts);
+    }
+
+    /**
+     * Read the cached change counts, as written by write_status_cache().
+     *
+     * @param repo The repository.
+     * @param key The key the counts must have been cached with.
+     * @param out The counts to fill in.
+     * @return True if counts were cached with the given key.
+     */
+    bool read_status_cache(const Repository &repo, const string &key, ChangeCounts &out) {
+        ifstream file(repo.path() + STATUS_CACHE_FILE);
+        string cachedKey;
+        if (!getline(file, cachedKey) || cachedKey != key) {
+            return false;
+        }
+        file >> out.added >> out.deleted >> out.modified >> out.renamed >> out.copied;
+        return !file.fail();
+    }
+
+    /**
+     * Cache change counts under a key, on the first line of the file, with the counts on the second.
+     * The file is written under a temporary name and then renamed, so other processes never see a partial cache.
+     *
+     * @param repo The repository.
+     * @param key The key identifying the state the counts were taken in, which mustn't contain newlines.
+     * @param counts The counts to cache.
+     */
+    void write_status_cache(const Repository &repo, const string &key, const ChangeCounts &counts) {
+        const string path = repo.path() + STATUS_CACHE_FILE;
+        const string lockPath = path + ".lock";
+        write_all(key + "\n" + to_string(counts.added) + " " + to_string(counts.deleted) + " "
+                  + to_string(counts.modified) + " " + to_string(counts.renamed) + " "
+                  + to_string(counts.copied) + "\n", lockPath);
+
+        error_code ec;
+        std::filesystem::rename(lockPath, path, ec);
+        if (ec) {
+            std::filesystem::remove(lockPath, ec);
+            throw MetroException("Failed to write status cache: " + path);
+        }
+    }
+
+    ChangeCounts count_changes(const Repository &repo) {
+        Index index = repo.index();
+        FsmonitorQuery query = query_fsmonitor(repo);
+
+        // The counts only need recounting if HEAD, the index or the working directory have changed.
+        string key;
+        if (status_signature(repo, index, query, key)) {
+            Tree current = head_tree(repo);
+            key = (current.ptr() ? current.id().str() : "-") + " " + key;
+            replace(key.begin(), key.end(), '\n', ' ');
+        }
+        ChangeCounts counts;
+        if (!key.empty() && read_status_cache(repo, key, counts)) {
+            return counts;
+        }
+
+        Diff diff = worktree_changes(repo, query);
+        counts.added = diff.num_deltas_of_type(GIT_DELTA_ADDED) + diff.num_deltas_of_type(GIT_DELTA_UNTRACKED);
+        counts.deleted = diff.num_deltas_of_type(GIT_DELTA_DELETED);
+        counts.modified = diff.num_deltas_of_type(GIT_DELTA_MODIFIED);
+        counts.renamed = diff.num_deltas_of_type(GIT_DELTA_RENAMED);
+        counts.copied = diff.num_deltas_of_type(GIT_DELTA_COPIED);
+
+        if (!key.empty()) {
+            try {
+                write_status_cache(repo, key, counts);
+            } catch (MetroException &) {
+                // The cache is only an optimisation, so the counts are still good without it.
+            }
+        }
+        return counts;
+    }
+
     void commit(const Repository &repo, const string &updateRef, const string &message,
                 const vector<Commit> &parentCommits) {
         git_signature author = repo.default_signature();
@@ -70,8 +166,22 @@ namespace metro {
     }
 
     Index add_all(const Repository &repo) {
+        FsmonitorQuery query = query_fsmonitor(repo);
+        return add_all(repo, query);
+    }
+
+    Index add_all(const Repository &repo, FsmonitorQuery &query) {
         Index index = repo.index();
-        index.add_all(StrArray(), GIT_INDEX_ADD_DISABLE_PATHSPEC_MATCH, nullptr);
+        if (query.valid && scan_paths(repo, index, query.paths)) {
+            return index;
+        }
+        // The parallel scanner leaves repositories it can't handle to libgit2's own single-threaded scan.
+        if (!scan_worktree(repo, index)) {
+            index.add_all(StrArray(), GIT_INDEX_ADD_DISABLE_PATHSPEC_MATCH, nullptr);
+            // The monitor's paths can't be trusted to cover whatever made the scanner back off,
+            // such as a nested repository, so don't let the next query skip the full scan.
+            query.token.clear();
+        }
         return index;
     }
 
@@ -206,6 +316,11 @@ namespace metro {
             }
         }
 
+        // Deleting a branch that has only been fetched records it as synced first,
+        // so that the next sync deletes it from the remote.
+        if (!branch_exists(repo, name) && is_implicit_branch(repo, name)) {
+            create_implicit_branch(repo, name);
+        }
         if (!branch_exists(repo, name)) throw BranchNotFoundException(name);
 
         Branch branch = repo.lookup_branch(name, GIT_BRANCH_LOCAL);
@@ -229,13 +344,95 @@ namespace metro {
         repo.checkout_tree(tree, checkoutOpts);
     }
 
+    /**
+     * Creates the empty tree in the repository.
+     *
+     * @param repo Repo to create the tree in.
+     * @return The empty tree.
+     */
+    Tree empty_tree(const Repository& repo) {
+        Treebuilder empty = Treebuilder::create(repo);
+        OID oid = empty.write();
+        return repo.lookup_tree(oid);
+    }
+
+    /**
+     * Forcefully checks out every path touched by a diff from the target tree.
+     * Paths outside the diff are neither examined nor written, and if the diff is empty nothing is done.
+     *
+     * @param repo Repo to checkout in.
+     * @param diff Diff whose old and new paths should be checked out.
+     * @param target Tree to checkout the paths from.
+     * @param checkoutOpts Checkout options with the baseline already set. The strategy and paths are overwritten.
+     */
+    void checkout_diff_paths(const Repository& repo, Diff& diff, const Tree& target, git_checkout_options& checkoutOpts) {
+        size_t count = diff.num_deltas();
+        if (count == 0) {
+            return;
+        }
+
+        vector<string> paths;
+        for (size_t i = 0; i < count; i++) {
+            const git_diff_delta *delta = diff.get_delta(i);
+            paths.emplace_back(delta->old_file.path);
+            if (strcmp(delta->old_file.path, delta->new_file.path) != 0) {
+                paths.emplace_back(delta->new_file.path);
+            }
+        }
+
+        // Exact path matching lets libgit2 skip whole directories that contain no listed paths.
+        StrArray pathspec(paths);
+        checkoutOpts.checkout_strategy = GIT_CHECKOUT_FORCE | GIT_CHECKOUT_DISABLE_PATHSPEC_MATCH;
+        checkoutOpts.paths = *pathspec.ptr();
+        repo.checkout_tree(target.ptr() == nullptr ? empty_tree(repo) : target, checkoutOpts);
+    }
+
+    void checkout(const Repository &repo, const Tree &from, const Tree &to) {
+        // libgit2 can't diff two empty trees, and there would be nothing to do anyway.
+        if (from.ptr() == nullptr && to.ptr() == nullptr) {
+            return;
+        }
+
+        git_diff_options diffOpts = GIT_DIFF_OPTIONS_INIT;
+        Diff diff = Diff::tree_to_tree(repo, from, to, &diffOpts);
+
+        // Use the old tree as the baseline so files matching it can be replaced without being hashed.
+        Tree baseline = from.ptr() == nullptr ? empty_tree(repo) : from;
+        git_checkout_options checkoutOpts = GIT_CHECKOUT_OPTIONS_INIT;
+        checkoutOpts.baseline = baseline.ptr().get();
+        checkout_diff_paths(repo, diff, to, checkoutOpts);
+    }
+
+    Tree head_tree(const Repository &repo) {
+        try {
+            return get_commit(repo, "HEAD").tree();
+        } catch (GitException &ex) {
+            // The current branch might have no commits, which is ok.
+            return Tree();
+        }
+    }
+
     bool has_uncommitted_changes(const Repository &repo) {
-        git_status_options opts = GIT_STATUS_OPTIONS_INIT;
-        opts.show = GIT_STATUS_SHOW_INDEX_AND_WORKDIR;
-        opts.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED;
+        Index index = repo.index();
+        bool changed;
+        // With a filesystem monitor running, only the paths it reports can differ from the index.
+        // Otherwise probe the working directory, which stops at the first change found.
+        FsmonitorQuery query = query_fsmonitor(repo);
+        if (!(query.valid && paths_changed(repo, index, query.paths, changed)) && !probe_worktree(repo, index, changed)) {
+            git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+            opts.show = GIT_STATUS_SHOW_INDEX_AND_WORKDIR;
+            opts.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED;
+
+            StatusList status = repo.new_status_list(opts);
+            return status.entrycount() > 0;
+        }
+        if (changed) {
+            return true;
+        }
 
-        StatusList status = repo.new_status_list(opts);
-        return status.entrycount() > 0;
+        // The working directory matches the index, but the index may have changes of its own.
+        git_diff_options diffOpts = GIT_DIFF_OPTIONS_INIT;
+        return Diff::tree_to_index(repo, head_tree(repo), index, &diffOpts).num_deltas() > 0;
     }
 
     vector<StandaloneConflict> get_conflicts(const Index &index) {
@@ -247,10 +444,10 @@ namespace metro {
         return conflicts;
     }
 
-    void save_wip(const Repository &repo) {
+    bool commit_wip(const Repository &repo) {
         // If there are no changes since the last commit, don't bother with a WIP commit.
         if (!(has_uncommitted_changes(repo) || merge_ongoing(repo))) {
-            return;
+            return false;
         }
 
         Head head = get_head(repo);
@@ -280,8 +477,15 @@ namespace metro {
                 commit(repo, "refs/heads/" + wipName, "WIP", {});
             }
         }
+        return true;
+    }
+
+    void save_wip(const Repository &repo) {
+        if (!commit_wip(repo)) {
+            return;
+        }
 
-        if (headExists) {
+        if (head_exists(repo)) {
             reset_head(repo, get_commit(repo, get_head(repo).name), true);
         } else {
             reset_to_empty(repo);
@@ -361,7 +565,15 @@ namespace metro {
         }
 
         // Restore the contents of the WIP commit to the working directory.
-        checkout(repo, wipName);
+        if (force || wipCommit.parentcount() > 1) {
+            // Either the working directory was never checked, or restarting the merge has changed it,
+            // so the whole WIP tree must be checked out.
+            checkout(repo, wipCommit);
+        } else {
+            // The working directory was found to match HEAD above,
+            // so only the paths changed by the WIP commit need updating.
+            checkout(repo, head_tree(repo), wipCommit.tree());
+        }
         delete_branch(repo, wipName);
 
         // If we are mid-merge, restore the conflicts from the merge.
@@ -449,6 +661,10 @@ namespace metro {
     }
 
     void switch_branch(const Repository& repo, const string& name, bool saveWip, bool restoreWip) {
+        // Branches that have only been fetched get their local refs the first time they are switched to.
+        if (!branch_exists(repo, name) && is_implicit_branch(repo, name)) {
+            create_implicit_branch(repo, name);
+        }
         const Commit commit = get_commit(repo, name);
 
         if (saveWip) {
@@ -457,7 +673,8 @@ namespace metro {
             reset_head(repo, get_commit(repo, "HEAD"), true);
         }
 
-        checkout(repo, commit);
+        // The working directory now matches HEAD, so only the paths that differ in the target need to be touched.
+        checkout(repo, head_tree(repo), commit.tree());
         move_head(repo, name);
 
         if (restoreWip && !repo.head_detached()) {
@@ -519,17 +736,26 @@ namespace metro {
     }
 
     void reset_head(const Repository& repo, const Commit& commit, bool hard) {
+        git_checkout_options checkoutOpts = GIT_CHECKOUT_OPTIONS_INIT;
         if (hard) {
             // Changes must be staged, or else they won't get reverted.
             Index index = add_all(repo);
             index.write();
-        }
 
-        git_checkout_options checkoutOpts = GIT_CHECKOUT_OPTIONS_INIT;
-        checkoutOpts.checkout_strategy = GIT_CHECKOUT_FORCE;
-        git_reset_t resetType = hard? GIT_RESET_HARD : GIT_RESET_SOFT;
+            // The index now matches the working directory, so only the paths where it differs
+            // from the target tree need to be checked out.
+            Tree target = commit.tree();
+            git_diff_options diffOpts = GIT_DIFF_OPTIONS_INIT;
+            Diff diff = Diff::tree_to_index(repo, target, index, &diffOpts);
+            checkoutOpts.baseline_index = index.ptr().get();
+            checkout_diff_paths(repo, diff, target, checkoutOpts);
 
-        repo.reset_to_commit(commit, resetType, checkoutOpts);
+            // Like a hard reset, clear any ongoing merge.
+            repo.cleanup_state();
+        }
+
+        // The working directory and index are already up to date, so only HEAD needs to move.
+        repo.reset_to_commit(commit, GIT_RESET_SOFT, checkoutOpts);
     }
 
     StrArray reference_list(const Repository& repo) {
@@ -541,9 +767,7 @@ namespace metro {
 
     void reset_to_empty(const Repository& repo) {
         // We create an empty tree to replace the working directory with
-        Treebuilder empty = Treebuilder::create(repo);
-        OID oid = empty.write();
-        Tree tree = repo.lookup_tree(oid);
+        Tree tree = empty_tree(repo);
 
         // Then we simply checkout the tree
         git_checkout_options checkoutOpts = GIT_CHECKOUT_OPTIONS_INIT;
@@ -12,40 +12,127 @@ namespace metro {
         }
     }
 
-    bool DualTarget::is_valid(const Repository& repo, map<OID, OID>& wipCommits) const {
+    bool DualTarget::is_valid(const Repository& repo, const unordered_map<OID, OID>& wipCommits) const {
         if (hasWip) {
             // head should never be null if hasWip is true.
             // If the base is null, any commit would be a valid WIP.
             //
             // The first parent should always be the head of the base branch (if present),
             // even if the WIP commit is a merge.
-            return !head.isNull && (base.isNull || repo.lookup_commit(wipCommits[head]).parent(0).id() == base);
+            return !head.isNull && (base.isNull || repo.lookup_commit(wipCommits.at(head)).parent(0).id() == base);
         } else {
             return true;
         }
     }
 
+    /**
+     * Checks whether a base branch name matches a pattern limiting which branches are synced.
+     * The pattern may contain one '*', which matches any sequence of characters.
+     *
+     * @param pattern The pattern to match against. An empty pattern matches every branch.
+     * @param name The base branch name.
+     * @return True if the branch matches the pattern.
+     */
+    bool matches_branch_pattern(const string& pattern, const string& name) {
+        if (pattern.empty()) {
+            return true;
+        }
+
+        size_t star = pattern.find('*');
+        if (star == string::npos) {
+            return name == pattern;
+        }
+        size_t suffixLength = pattern.size() - star - 1;
+        return name.size() >= pattern.size() - 1
+               && name.compare(0, star, pattern, 0, star) == 0
+               && name.compare(name.size() - suffixLength, suffixLength, pattern, star + 1, suffixLength) == 0;
+    }
+
+    /**
+     * Remove the branches that don't match a pattern from branchTargets.
+     *
+     * @param branchTargets List of targets for each branch.
+     * @param pattern The pattern to match, as accepted by matches_branch_pattern().
+     * @param except Name of a branch to remove even if it matches, or an empty string.
+     */
+    void filter_branch_targets(BranchTargets& branchTargets, const string& pattern, const string& except) {
+        if (pattern.empty() && except.empty()) {
+            return;
+        }
+        for (auto iter = branchTargets.begin(); iter != branchTargets.end();) {
+            if (matches_branch_pattern(pattern, iter->first) && iter->first != except) {
+                ++iter;
+            } else {
+                iter = branchTargets.erase(iter);
+            }
+        }
+    }
+
+    /**
+     * Find the greatest version number in use with each base branch name,
+     * so that conflict branches can be named without rescanning every branch.
+     *
+     * @param branchTargets List of targets for each branch.
+     * @param advertised The references advertised by the remote, which may include branches
+     *        that have not been fetched.
+     * @return Map from base branch names to the greatest version number in use.
+     */
+    unordered_map<string, int> get_conflict_versions(const BranchTargets& branchTargets,
+                                                     const map<string, OID>& advertised) {
+        unordered_map<string, int> versions;
+        auto add_version = [&versions](const string& name) {
+            BranchDescriptor d(name);
+            int& version = versions[d.baseName];
+            version = max(version, d.version);
+        };
+
+        for (const auto& entry : branchTargets) {
+            add_version(entry.first);
+        }
+        for (const auto& entry : advertised) {
+            if (has_prefix(entry.first, "refs/heads/")) {
+                add_version(un_wip(entry.first.substr(strlen("refs/heads/"))));
+            }
+        }
+        return versions;
+    }
+
     /**
      * Increment the version number of a branch name to the next unused one for that branch.
+     * The new version is recorded as in use.
      *
      * @param name Name of the branch.
-     * @param branchTargets List of targets for each branch.
+     * @param versions The greatest version number in use with each base name, from get_conflict_versions().
      * @return The next valid branch name derivitive.
      */
-    string next_conflict_branch_name(const string& name, const map<string, RefTargets>& branchTargets) {
+    string next_conflict_branch_name(const string& name, unordered_map<string, int>& versions) {
         BranchDescriptor nextDesc(name);
-        // Find the current greatest version number in use with this base name.
-        for(const auto& entry : branchTargets) {
-            BranchDescriptor d(entry.first);
-            if (d.baseName == nextDesc.baseName) {
-                nextDesc.version = max(nextDesc.version, d.version);
-            }
-        }
         // Increment to the next unused number.
-        nextDesc.version++;
+        int& version = versions[nextDesc.baseName];
+        version = max(version, nextDesc.version) + 1;
+        nextDesc.version = version;
         return nextDesc.full_name();
     }
 
+    /**
+     * List the entries of branchTargets in order of branch name, so that branches are always synced
+     * in the same order.
+     *
+     * @param branchTargets List of targets for each branch.
+     * @return Pointers to the entries of branchTargets, sorted by name.
+     */
+    vector<const BranchTargets::value_type*> sorted_branch_targets(const BranchTargets& branchTargets) {
+        vector<const BranchTargets::value_type*> sorted;
+        sorted.reserve(branchTargets.size());
+        for (const auto& entry : branchTargets) {
+            sorted.push_back(&entry);
+        }
+        std::sort(sorted.begin(), sorted.end(), [](const auto *a, const auto *b) {
+            return a->first < b->first;
+        });
+        return sorted;
+    }
+
     OID wip_commit_hash(const Repository& repo, const OID& commit_oid) {
         Commit commit = repo.lookup_commit(commit_oid);
 
@@ -70,6 +157,249 @@ namespace metro {
         return OID(commit_hash);
     }
 
+    /**
+     * Read the entries of a WIP hash memo file. Lines that aren't valid entries are skipped.
+     *
+     * @param path Path of the memo file.
+     * @return Pairs of commit OIDs and their WIP hashes, most recently used first.
+     *         Empty if the file doesn't exist.
+     * @throws MetroException If the file can't be read.
+     */
+    vector<pair<OID, OID>> read_wip_hash_memo(const string& path) {
+        vector<pair<OID, OID>> lines;
+        error_code ec;
+        if (!std::filesystem::exists(path, ec)) {
+            return lines;
+        }
+
+        string contents = read_all(path);
+        size_t start = 0;
+        while (start < contents.size()) {
+            size_t end = contents.find('\n', start);
+            if (end == string::npos) {
+                end = contents.size();
+            }
+            // Each line holds a commit OID, followed by a space and its WIP hash.
+            if (end - start == 2 * GIT_OID_HEXSZ + 1) {
+                lines.emplace_back(OID(contents.substr(start, GIT_OID_HEXSZ)),
+                                   OID(contents.substr(start + GIT_OID_HEXSZ + 1, GIT_OID_HEXSZ)));
+            }
+            start = end + 1;
+        }
+        return lines;
+    }
+
+    WipHashMemo::WipHashMemo(const Repository& repo) : repo(&repo) {
+        // The memo is only an optimisation, so rather than failing the sync a bad memo file is ignored
+        // and will be overwritten with a good one.
+        try {
+            vector<pair<OID, OID>> lines = read_wip_hash_memo(repo.path() + WIP_HASH_MEMO_FILE);
+            // The file lists the most recently used entries first.
+            for (size_t i = 0; i < lines.size(); i++) {
+                entries.try_emplace(lines[i].first, Entry{lines[i].second, lines.size() - i});
+            }
+            clock = lines.size() + 1;
+        } catch (exception& e) {
+            entries.clear();
+        }
+    }
+
+    OID WipHashMemo::hash(const OID& commitOid) {
+        auto memoized = entries.find(commitOid);
+        if (memoized != entries.end()) {
+            memoized->second.lastUse = clock++;
+            return memoized->second.wipHash;
+        }
+
+        OID wipHash = wip_commit_hash(*repo, commitOid);
+        entries.emplace(commitOid, Entry{wipHash, clock++});
+        changed = true;
+        return wipHash;
+    }
+
+    void WipHashMemo::save() const {
+        if (!changed) {
+            return;
+        }
+
+        // Lock the memo before reading it again, so that hashes memoized by another sync in the meantime are kept.
+        // If another process holds the lock for too long, just skip saving, as the memo is only an optimisation.
+        const string path = repo->path() + WIP_HASH_MEMO_FILE;
+        optional<FileLock> lock;
+        try {
+            lock.emplace(path);
+        } catch (MetroException&) {
+            return;
+        }
+
+        unordered_map<OID, Entry> merged = entries;
+        try {
+            vector<pair<OID, OID>> lines = read_wip_hash_memo(path);
+            for (size_t i = 0; i < lines.size(); i++) {
+                merged.try_emplace(lines[i].first, Entry{lines[i].second, lines.size() - i});
+            }
+        } catch (exception& e) {
+            // A bad memo file is overwritten.
+        }
+
+        // Write the most recently used entries first, dropping the least recently used beyond the limit.
+        vector<const pair<const OID, Entry>*> sorted;
+        sorted.reserve(merged.size());
+        for (const auto& entry : merged) {
+            sorted.push_back(&entry);
+        }
+        std::sort(sorted.begin(), sorted.end(), [](const auto *a, const auto *b) {
+            return a->second.lastUse > b->second.lastUse;
+        });
+        sorted.resize(min(sorted.size(), (size_t) WIP_HASH_MEMO_LIMIT));
+
+        string contents;
+        for (const auto *entry : sorted) {
+            contents += entry->first.str() + " " + entry->second.wipHash.str() + "\n";
+        }
+        lock->commit(contents);
+    }
+
+    /**
+     * Work out how many refs a RefBatch can lock in one transaction, as each lock holds a file open.
+     * The open file limit is raised once at startup by raise_open_file_limit(), so it is only read here.
+     *
+     * @return The number of refs to lock at once.
+     */
+    size_t compute_ref_batch_limit() {
+#ifdef _WIN32
+        return REF_BATCH_LIMIT;
+#else
+        rlimit files{};
+        if (getrlimit(RLIMIT_NOFILE, &files) != 0) {
+            return REF_BATCH_LIMIT;
+        }
+        if (files.rlim_cur == RLIM_INFINITY) {
+            return numeric_limits<size_t>::max();
+        }
+        const auto available = (size_t) files.rlim_cur;
+        return available > 2 * REF_BATCH_RESERVED_FILES ? available - REF_BATCH_RESERVED_FILES : available / 2;
+#endif //_WIN32
+    }
+
+    /**
+     * @return The number of refs a RefBatch can lock in one transaction, computed on first use.
+     */
+    size_t ref_batch_limit() {
+        static const size_t limit = compute_ref_batch_limit();
+        return limit;
+    }
+
+    RefBatch::RefBatch(const Repository& repo) : repo(&repo), transaction(Transaction::create(repo)),
+                                                 limit(ref_batch_limit()) {}
+
+    void RefBatch::lock(const string& refName) {
+        if (locked.find(refName) != locked.end()) {
+            return;
+        }
+        // Every lock holds a file open until the transaction is committed,
+        // so very large batches are committed in chunks to stay within the open file limit.
+        if (locked.size() >= limit) {
+            flush();
+            if (heldHead) {
+                transaction.lock_ref("HEAD");
+                locked.insert("HEAD");
+                const Head head = get_head(*repo);
+                if (head.name != heldHead->name || head.detached != heldHead->detached) {
+                    throw MetroException("The current branch was switched while syncing; sync again to finish.");
+                }
+            }
+        }
+        transaction.lock_ref(refName);
+        locked.insert(refName);
+    }
+
+    void RefBatch::flush() {
+        // Take the removals out first, as locking them may flush again.
+        const unordered_set<string> toRemove = std::move(removed);
+        removed.clear();
+        for (const string& refName : toRemove) {
+            lock(refName);
+            transaction.remove(refName);
+        }
+
+        if (!locked.empty()) {
+            transaction.commit();
+        }
+        // Start a fresh transaction; the old one releases its locks when freed.
+        transaction = Transaction::create(*repo);
+        locked.clear();
+    }
+
+    void RefBatch::set_target(const string& branchName, const OID& target) {
+        set_reference("refs/heads/" + branchName, target);
+    }
+
+    void RefBatch::remove(const string& branchName) {
+        const string refName = "refs/heads/" + branchName;
+        if (removed.find(refName) != removed.end() || !branch_exists(*repo, branchName)) {
+            return;
+        }
+        removed.insert(refName);
+
+        // Also delete the WIP branch if present, as delete_branch() would.
+        if (!is_wip(branchName)) {
+            remove(to_wip(branchName));
+        }
+    }
+
+    void RefBatch::set_reference(const string& refName, const OID& target) {
+        removed.erase(refName);
+        lock(refName);
+        transaction.set_target(refName, target, "metro: sync");
+    }
+
+    void RefBatch::remove_reference(const string& refName) {
+        if (repo->reference_exists(refName)) {
+            removed.insert(refName);
+        }
+    }
+
+    Head RefBatch::lock_head() {
+        lock("HEAD");
+        heldHead = get_head(*repo);
+        return *heldHead;
+    }
+
+    void RefBatch::set_head(const string& branchName) {
+        lock("HEAD");
+        transaction.set_symbolic_target("HEAD", "refs/heads/" + branchName, "metro: sync");
+    }
+
+    void RefBatch::checkout_after(const Tree& from, const Tree& to) {
+        // Only the first tree the working directory matches is known, so keep it if the branch moves twice.
+        if (!checkoutNeeded) {
+            oldTree = from;
+        }
+        newTree = to;
+        checkoutNeeded = true;
+    }
+
+    void RefBatch::delete_after(const string& branchName) {
+        deleteAfter = branchName;
+    }
+
+    void RefBatch::commit() {
+        heldHead.reset();
+        flush();
+
+        if (checkoutNeeded) {
+            checkout(*repo, oldTree, newTree);
+            checkoutNeeded = false;
+        }
+        if (!deleteAfter.empty()) {
+            if (branch_exists(*repo, deleteAfter)) {
+                delete_branch(*repo, deleteAfter);
+            }
+            deleteAfter.clear();
+        }
+    }
+
     /**
      * Replace local and remote WIP branch targets with their corresponding WIP commit hashes, generated by
      * wip_commit_hash(). Synced targets are not affected, as they are already stored as WIP hashes.
@@ -78,83 +408,136 @@ namespace metro {
      * @param branchTargets The targets to replace.
      * @param wipCommits Outputs a map from WIP hashes to a commit that has that hash,
      *        so that the underlying commit data can be retrieved.
+     * @param wipHashes Memo used to avoid rehashing WIP commits.
      */
-    void hash_wip_commits(const Repository& repo, map<string, RefTargets>& branchTargets, map<OID, OID>& wipCommits) {
+    void hash_wip_commits(const Repository& repo, BranchTargets& branchTargets, unordered_map<OID, OID>& wipCommits,
+            WipHashMemo& wipHashes) {
         for(auto& entry : branchTargets) {
-            const string branchName = entry.first;
-            RefTargets targets = entry.second;
+            RefTargets& targets = entry.second;
 
             if (targets.local.hasWip) {
-                const OID wipHash = wip_commit_hash(repo, targets.local.head);
+                const OID wipHash = wipHashes.hash(targets.local.head);
                 wipCommits[wipHash] = targets.local.head;
-                entry.second.local.head = wipHash;
+                targets.local.head = wipHash;
             }
             if (targets.remote.hasWip) {
-                const OID wipHash = wip_commit_hash(repo, targets.remote.head);
+                const OID wipHash = wipHashes.hash(targets.remote.head);
                 wipCommits[wipHash] = targets.remote.head;
-                entry.second.remote.head = wipHash;
+                targets.remote.head = wipHash;
             }
         }
     }
 
     /**
-     * Create or overwrite a branch entry in the sync cache, which is stored at .git/synced/ for non-bare repos.
-     * Like regular Git references, branch names with forward slashes in them are converted into nested
-     * subdirectories.
+     * Read the entries of a sync cache in the legacy layout, which stored one file per branch
+     * at .git/synced/ in non-bare repos.
+     * If the legacy sync cache directory does not exist, the output map is unchanged.
+     * Nested subdirectories within the sync cache directory are treated as branch names with forward slashes in them,
+     * as with regular Git references.
      *
      * @param repo The repository.
-     * @param name The name of the branch.
-     * @param value The OID to store in the branch's cache file.
+     * @param out The map to write the entries to.
      */
-    void create_cache_entry(const Repository& repo, const string& name, const OID& value) {
-        // Create the sync cache root directory if it doesn't already exist.
+    void read_legacy_sync_cache(const Repository& repo, map<string, OID>& out) {
+        string cacheRoot = repo.path() + LEGACY_SYNC_CACHE_DIR;
+
+        // Check that the sync cache directory exists before trying to read it.
+        struct stat info{};
         _set_errno(0);
-        int err = _mkdir((repo.path() + "synced").c_str());
-        if (err != 0 && errno != EEXIST) {
-            throw MetroException("Failed to initialize sync cache");
+        int err = stat(cacheRoot.c_str(), &info);
+        if (err != 0 && errno != ENOENT) {
+            throw MetroException("Error accessing " + cacheRoot);
         }
 
-        // If the branch name contains slashes, create all the parent directories first.
-        size_t pos = name.find('/');
-        while (pos != string::npos) {
-            _set_errno(0);
-            err = _mkdir((repo.path() + "synced/" + name.substr(0, pos)).c_str());
-            if (err != 0 && errno != EEXIST) {
-                throw MetroException("Failed to create sync cache entry for " + name);
+        if (info.st_mode & S_IFDIR) {
+            std::filesystem::recursive_directory_iterator end;
+            std::filesystem::recursive_directory_iterator iter(cacheRoot);
+
+            while (iter != end) {
+                string path = iter->path().string();
+
+                // Only try to read regular files; skip over directories returned by the iterator.
+                if (std::filesystem::is_regular_file(iter->path())) {
+                    // Remove the path prefix and following slash.
+                    string name = path.substr(cacheRoot.size() + 1);
+                    std::replace(name.begin(), name.end(), '\\', '/');
+                    out[name] = OID(read_all(path));
+                }
+
+                error_code ec;
+                iter.increment(ec);
+                if (ec) {
+                    throw MetroException("Error reading sync cache: " + ec.message());
+                }
             }
-            pos = name.find('/', pos+1);
         }
-
-        write_all(value.str(), repo.path() + "synced/" + name);
     }
 
     /**
-     * Delete a branch entry from the sync cache, if it exists.
-     * Subdirectories within the sync cache directory that become empty after the deletion are also deleted.
+     * Read the entries in the sync cache into a map.
+     *
+     * The sync cache is a single sorted file at .git/packed-synced in non-bare repos, similar to packed-refs.
+     * After a header line, each line holds the cached OID of a branch followed by a space and the branch name.
+     * If only a sync cache in the legacy directory layout exists, that is read instead; it will be
+     * migrated the next time the sync cache is written.
+     * If no sync cache exists, the output map is unchanged.
      *
      * @param repo The repository.
-     * @param name The branch to remove from the sync cache.
+     * @param out The map to write the entries to.
      */
-    void delete_cache_entry(const Repository& repo, const string& name) {
+    void read_sync_cache(const Repository& repo, map<string, OID>& out) {
+        string path = repo.path() + SYNC_CACHE_FILE;
         error_code ec;
-        std::filesystem::remove((repo.path() + "synced/" + name).c_str(), ec);
+        if (!std::filesystem::exists(path, ec)) {
+            read_legacy_sync_cache(repo, out);
+            return;
+        }
+
+        // Read the whole file at once, rather than making a syscall per entry.
+        string contents = read_all(path);
+        size_t start = 0;
+        while (start < contents.size()) {
+            size_t end = contents.find('\n', start);
+            if (end == string::npos) {
+                end = contents.size();
+            }
 
-        // Delete empty parent directories.
-        size_t pos = name.find_last_of('/');
-        while (pos != string::npos) {
-            string directory = repo.path() + "synced/" + name.substr(0, pos);
-            // Don't delete parent directories if they are not empty or do not exist.
-            if (!std::filesystem::is_empty(directory, ec)) {
-                break;
+            // Skip the header and any blank lines.
+            if (end > start && contents[start] != '#') {
+                if (end - start < GIT_OID_HEXSZ + 2 || contents[start + GIT_OID_HEXSZ] != ' ') {
+                    throw MetroException("Corrupt sync cache: " + path);
+                }
+                string name = contents.substr(start + GIT_OID_HEXSZ + 1, end - start - GIT_OID_HEXSZ - 1);
+                out[name] = OID(contents.substr(start, GIT_OID_HEXSZ));
             }
-            std::filesystem::remove_all(directory.c_str());
+            start = end + 1;
+        }
+    }
 
-            pos = name.find_last_of('/', pos-1);
+    /**
+     * Replace the contents of the sync cache with the given entries.
+     * The file is written through its lock file and then renamed over the old one, so other
+     * processes never see a partially written cache. Any legacy sync cache directory is deleted afterwards.
+     *
+     * @param repo The repository.
+     * @param lock The lock on the sync cache, which must have been taken before the entries were read.
+     * @param entries The entries to store, which map branch names to their cached OIDs.
+     */
+    void write_sync_cache(const Repository& repo, FileLock& lock, const map<string, OID>& entries) {
+        // std::map is sorted, so the entries are written in order of name.
+        string contents = SYNC_CACHE_HEADER;
+        for (const auto& entry : entries) {
+            contents += entry.second.str() + " " + entry.first + "\n";
         }
+        lock.commit(contents);
+
+        error_code ec;
+        std::filesystem::remove_all(repo.path() + LEGACY_SYNC_CACHE_DIR, ec);
     }
 
     /**
      * Updates the sync cache entries for the specified branches.
+     * The sync cache is only written once, however many branches are updated.
      *
      * Non-WIP branches have their commit OIDs stored.
      * WIP branches have their WIP commit hashes stored, as generated by wip_commit_hash().
@@ -162,84 +545,128 @@ namespace metro {
      *
      * @param repo The repository.
      * @param branches Branch names for which to update the sync cache.
+     * @param wipHashes Memo used to avoid rehashing WIP commits.
      */
-    void update_sync_cache(const Repository& repo, const vector<string>& branches) {
+    void update_sync_cache(const Repository& repo, const vector<string>& branches, WipHashMemo& wipHashes) {
+        // Lock the cache before reading it, so that entries written by another sync in the meantime aren't lost.
+        FileLock lock(repo.path() + SYNC_CACHE_FILE);
+        map<string, OID> entries;
+        read_sync_cache(repo, entries);
+
         for (const auto& name : branches) {
             if (branch_exists(repo, name)) {
                 OID oid = repo.lookup_branch(name, GIT_BRANCH_LOCAL).target();
                 if (is_wip(name)) {
-                    oid = wip_commit_hash(repo, oid);
+                    oid = wipHashes.hash(oid);
                 }
-                create_cache_entry(repo, name, oid);
+                entries[name] = oid;
             } else {
-                delete_cache_entry(repo, name);
+                entries.erase(name);
             }
         }
+
+        write_sync_cache(repo, lock, entries);
     }
 
     /**
-     * Read the entries in the sync cache (located at .git/synced/ in non-bare repos) into a map.
-     * If the sync cache directory does not exist, the output map is unchanged.
-     * Nested subdirectories within the sync cache directory are treated as branch names with forward slashes in them,
-     * as with regular Git references.
+     * Get the WIP namespace set in the metro.wipNamespace config variable.
+     * When a namespace is set, WIP branches are pushed to refs/metro/wip/<namespace>/ on the remote
+     * instead of alongside the base branches, and only that namespace is fetched.
      *
      * @param repo The repository.
-     * @param out The map to write the entries to.
+     * @return The namespace, or an empty string if none is set.
+     * @throws MetroException If the namespace is not a valid ref name component.
      */
-    void read_sync_cache(const Repository& repo, map<string, OID>& out) {
-        string cacheRoot = repo.path() + "synced";
-
-        // Check that the sync cache directory exists before trying to read it.
-        struct stat info{};
-        _set_errno(0);
-        int err = stat(cacheRoot.c_str(), &info);
-        if (err != 0 && errno != ENOENT) {
-            throw MetroException("Error accessing " + cacheRoot);
+    string get_wip_namespace(const Repository& repo) {
+        string wipNamespace;
+        try {
+            wipNamespace = repo.config().get_string_buf(WIP_NAMESPACE_CONFIG);
+        } catch (GitException&) {
+            return "";
         }
 
-        if (info.st_mode & S_IFDIR) {
-            std::filesystem::recursive_directory_iterator end;
-            std::filesystem::recursive_directory_iterator iter(cacheRoot);
-
-            while (iter != end) {
-                string path = iter->path().string();
+        // Slashes are disallowed so that no namespace can be nested inside another.
+        if (!wipNamespace.empty() && (wipNamespace.find('/') != string::npos
+                || !git_reference_is_valid_name((REMOTE_WIP_PREFIX + wipNamespace + "/HEAD").c_str()))) {
+            throw MetroException("Invalid " WIP_NAMESPACE_CONFIG " '" + wipNamespace
+                                 + "'; it must be usable as a single component of a ref name.");
+        }
+        return wipNamespace;
+    }
 
-                // Only try to read regular files; skip over directories returned by the iterator.
-                if (std::filesystem::is_regular_file(iter->path())) {
-                    // Remove the path prefix and following slash.
-                    string name = path.substr(cacheRoot.size() + 1);
-                    std::replace(name.begin(), name.end(), '\\', '/');
-                    out[name] = OID(read_all(path));
-                }
+    /**
+     * Get the pattern limiting the branches synced by default, set in the metro.syncOnly config variable.
+     *
+     * @param repo The repository.
+     * @return The pattern, as accepted by matches_branch_pattern(), or an empty string if none is set.
+     */
+    string get_sync_only(const Repository& repo) {
+        try {
+            return repo.config().get_string_buf(SYNC_ONLY_CONFIG);
+        } catch (GitException&) {
+            return "";
+        }
+    }
 
-                error_code ec;
-                iter.increment(ec);
-                if (ec) {
-                    throw MetroException("Error reading sync cache: " + ec.message());
-                }
+    /**
+     * Print the local branches that are left out of syncs by the metro.syncOnly config variable,
+     * so that branches created after a single-branch clone aren't silently never pushed.
+     * WIP branches aren't listed, as they follow their base branches.
+     *
+     * @param repo The repository.
+     * @param only The pattern from get_sync_only(). Nothing is printed if it is empty.
+     */
+    void report_unsynced_branches(const Repository& repo, const string& only) {
+        if (only.empty()) {
+            return;
+        }
+        BranchIterator iter = repo.new_branch_iterator(GIT_BRANCH_LOCAL);
+        for (Branch branch; iter.next(&branch);) {
+            const string name = branch.name();
+            if (!is_wip(name) && !matches_branch_pattern(only, name)) {
+                cout << "Branch " << name << " is not synced because " SYNC_ONLY_CONFIG " is set to '" << only
+                     << "'." << endl;
             }
         }
     }
 
     /**
-     * Check if the given reference name starts with the specified prefix, and if so remove the prefix from the name
-     * and ensure that there is an entry for that name in branchTargets by creating a blank one if needed.
+     * Name of the remote ref a local branch is pushed to.
      *
-     * @param branchTargets List of targets for each branch.
-     * @param name The name reference to remove the prefix from.
-     * @param prefix Prefix to remove from name.
-     * @return True if the prefix existed and was removed.
+     * @param branchName Name of the local branch.
+     * @param wipNamespace The WIP namespace from get_wip_namespace(), or an empty string.
+     * @return The ref in the user's WIP namespace if this is a WIP branch and a namespace is set,
+     *         otherwise the branch of the same name on the remote.
+     */
+    string remote_ref_name(const string& branchName, const string& wipNamespace) {
+        if (!wipNamespace.empty() && is_wip(branchName)) {
+            return REMOTE_WIP_PREFIX + wipNamespace + "/" + un_wip(branchName);
+        }
+        return "refs/heads/" + branchName;
+    }
+
+    /**
+     * Get the branch name a ref advertised by the remote corresponds to locally.
+     * With a WIP namespace set, WIP branches are only taken from that namespace,
+     * and any WIP branches pushed without a namespace are ignored.
+     *
+     * @param refName Name of the advertised ref.
+     * @param wipNamespace The WIP namespace from get_wip_namespace(), or an empty string.
+     * @return The branch name, with the WIP suffix for WIP branches, or an empty string if the ref is not synced.
      */
-    bool prepare_branch_targets(map<string, RefTargets>& branchTargets, string& name, const string& prefix) {
-        if (has_prefix(name, prefix)) {
-            name = name.substr(prefix.size(), name.size() - prefix.size());
-            // Create a blank entry if none is present.
-            if (branchTargets.find(name) == branchTargets.end()) {
-                branchTargets[name] = RefTargets();
+    string advertised_branch_name(const string& refName, const string& wipNamespace) {
+        if (has_prefix(refName, "refs/heads/")) {
+            string name = refName.substr(strlen("refs/heads/"));
+            if (wipNamespace.empty() || !is_wip(name)) {
+                return name;
+            }
+        } else if (!wipNamespace.empty()) {
+            const string prefix = REMOTE_WIP_PREFIX + wipNamespace + "/";
+            if (has_prefix(refName, prefix)) {
+                return to_wip(refName.substr(prefix.size()));
             }
-            return true;
         }
-        return false;
+        return "";
     }
 
     /**
@@ -247,10 +674,14 @@ namespace metro {
      * The local and remote targets will always be the actual commit OIDs, while the synced targets for WIP branches
      * will be WIP commit hashes as read from the sync cache.
      *
+     * With a WIP namespace set, remote WIP targets are read from the refs tracking that namespace
+     * rather than from the WIP branches in refs/remotes/origin/.
+     *
      * @param repo The repository.
      * @param out Output for the local, remote and synced targets for each branch.
+     * @param wipNamespace The WIP namespace from get_wip_namespace(), or an empty string.
      */
-    void get_branch_targets(const Repository& repo, map<string, RefTargets> *out) {
+    void get_branch_targets(const Repository& repo, BranchTargets *out, const string& wipNamespace) {
         // Read targets from the sync cache.
         map<string, OID> synced;
         read_sync_cache(repo, synced);
@@ -260,17 +691,19 @@ namespace metro {
             name = un_wip(name);
 
             // Create an empty RefTargets if none is present.
-            if (out->find(name) == out->end()) {
-                (*out)[name] = RefTargets();
-            }
             (*out)[name].synced.add_target(entry.second, isWip);
         }
 
         // Read local and remote targets from repo.
+        struct TargetsPayload {
+            BranchTargets *branchTargets;
+            bool namespaced;
+        } payload{out, !wipNamespace.empty()};
         repo.foreach_reference([](const Branch& ref, const void *payload) {
             // Only try to sync direct references.
             if (ref.type() == GIT_REFERENCE_DIRECT) {
-                auto branchTargets = (map<string, RefTargets> *) payload;
+                auto targetsPayload = (const TargetsPayload *) payload;
+                BranchTargets *branchTargets = targetsPayload->branchTargets;
 
                 // Base and WIP branches will be paired together in a DualTarget.
                 string name = ref.reference_name();
@@ -279,10 +712,16 @@ namespace metro {
 
                 // Create an empty RefTargets if none is present and get the corresponding DualTarget from it.
                 DualTarget *dualTarget = nullptr;
-                if (prepare_branch_targets(*branchTargets, name, "refs/heads/")) {
-                    dualTarget = &(*branchTargets)[name].local;
-                } else if (prepare_branch_targets(*branchTargets, name, "refs/remotes/origin/")) {
-                    dualTarget = &(*branchTargets)[name].remote;
+                if (has_prefix(name, "refs/heads/")) {
+                    dualTarget = &(*branchTargets)[name.substr(strlen("refs/heads/"))].local;
+                } else if (has_prefix(name, "refs/remotes/origin/")) {
+                    // Other users' WIP branches are ignored when WIP branches are kept in a namespace.
+                    if (!(isWip && targetsPayload->namespaced)) {
+                        dualTarget = &(*branchTargets)[name.substr(strlen("refs/remotes/origin/"))].remote;
+                    }
+                } else if (targetsPayload->namespaced && has_prefix(name, TRACKING_WIP_PREFIX)) {
+                    dualTarget = &(*branchTargets)[name.substr(strlen(TRACKING_WIP_PREFIX))].remote;
+                    isWip = true;
                 }
 
                 if (dualTarget != nullptr) {
@@ -290,66 +729,294 @@ namespace metro {
                 }
             }
             return 0;
-        }, out);
+        }, &payload);
     }
 
     /**
-     * Refspec to push the specified branch, deleting the remote branch if requested.
+     * Checks whether a branch is implicit: it exists on the remote, but has never been created locally or synced.
+     * Implicit branches are treated as local branches that match the remote, so local refs are only
+     * created for them once they are needed.
      *
-     * @param branchName Name of the branch to make push.
-     * @param deleting Whether the remote branch should be deleted.
-     * @return The final created refspec.
+     * @param targets The local, remote and synced targets of the branch.
+     * @return True if the branch is implicit.
      */
-    string make_push_refspec(const string& branchName, bool deleting) {
-        if (deleting) {
-            return ":refs/heads/" + branchName;
-        } else {
-            return "+refs/heads/" + branchName + ":refs/heads/" + branchName;
-        }
+    bool is_implicit(const RefTargets& targets) {
+        return targets.local.head.isNull && targets.synced.head.isNull && !targets.remote.head.isNull;
     }
 
     /**
-     * Add refspecs for pushing the specified base branch and its WIP branch.
-     * Only pushes each branch if the local and remote targets differ.
+     * Remove implicit branches from a BranchTargets, as they are always in sync with the remote.
+     * The current branch is never implicit, even if it has no commits yet.
      *
-     * @param branchName Branch to queue up for push.
-     * @param targets Targets to compare to branch.
-     * @param refspecs Refspecs reference to add created refspec to
+     * @param branchTargets The targets to filter.
+     * @param head The current head of the repo.
      */
-    void queue_push(const string& branchName, const RefTargets& targets, vector<string>& refspecs) {
-        if (targets.local.base != targets.remote.base) {
-            refspecs.push_back(make_push_refspec(branchName, targets.local.base.isNull));
+    void remove_implicit_branches(BranchTargets& branchTargets, const Head& head) {
+        for (auto it = branchTargets.begin(); it != branchTargets.end();) {
+            if (is_implicit(it->second) && (head.detached || it->first != head.name)) {
+                it = branchTargets.erase(it);
+            } else {
+                ++it;
+            }
         }
+    }
 
-        // If neither side has a WIP branch, don't try to push it.
-        // If exactly one does, then push; in this case the heads are guaranteed to differ assuming valid WIP branch.
-        // If both have WIP branches only push if the heads differ.
-        if ((targets.local.hasWip || targets.remote.hasWip) && targets.local.head != targets.remote.head) {
-            refspecs.push_back(make_push_refspec(to_wip(branchName), !targets.local.hasWip));
+    bool is_implicit_branch(const Repository& repo, const string& name) {
+        if (is_wip(name) || is_on_branch(repo, name)) {
+            return false;
         }
+        BranchTargets branchTargets;
+        get_branch_targets(repo, &branchTargets, get_wip_namespace(repo));
+        const auto targets = branchTargets.find(name);
+        return targets != branchTargets.end() && is_implicit(targets->second);
     }
-    
-    /**
-     * Move the specified branch to a new target.
-     * Effectively performs a force pull if the new target is a commit fetched from a remote.
-     * Can create and delete branches as needed.
-     *
-     * @param repo The repo to change the branch target within.
-     * @param branchName The branch to move to a new target.
-     * @param newTarget The new target the branch is moved to.
-     */
-    void change_branch_target(const Repository& repo, const string& branchName, const OID& newTarget) {
-        if (newTarget.isNull) {
-            // If this was a WIP branch it might already have been deleted when the base branch was deleted.
-            if ((branch_exists(repo, branchName))) {
-                delete_branch(repo, branchName);
-            }
+
+    map<string, bool> implicit_branches(const Repository& repo) {
+        BranchTargets branchTargets;
+        get_branch_targets(repo, &branchTargets, get_wip_namespace(repo));
+        const Head head = get_head(repo);
+
+        map<string, bool> implicit;
+        for (const auto& entry : branchTargets) {
+            if (is_implicit(entry.second) && (head.detached || entry.first != head.name)) {
+                implicit[entry.first] = entry.second.remote.hasWip;
+            }
+        }
+        return implicit;
+    }
+
+    void create_implicit_branch(const Repository& repo, const string& name) {
+        BranchTargets branchTargets;
+        get_branch_targets(repo, &branchTargets, get_wip_namespace(repo));
+        const RefTargets& targets = branchTargets.at(name);
+        assert(is_implicit(targets));
+
+        RefBatch batch(repo);
+        if (!targets.remote.base.isNull) {
+            batch.set_target(name, targets.remote.base);
+        }
+        if (targets.remote.hasWip) {
+            batch.set_target(to_wip(name), targets.remote.head);
+        }
+        batch.commit();
+
+        // The new branches match the remote, so record them as synced;
+        // otherwise local commits made before the next sync would look like a conflict.
+        WipHashMemo wipHashes(repo);
+        update_sync_cache(repo, {name, to_wip(name)}, wipHashes);
+        wipHashes.save();
+    }
+
+    /**
+     * Whether local WIP commit chains should be squashed when syncing, as set by metro.autoSquashWip.
+     *
+     * @param repo The repository.
+     * @return True if chains should be squashed.
+     */
+    bool auto_squash_wip(const Repository& repo) {
+        try {
+            return repo.config().get_bool(AUTO_SQUASH_WIP_CONFIG);
+        } catch (GitException&) {
+            return false;
+        }
+    }
+
+    /**
+     * Squash a chain of WIP commits on top of a base branch into a single WIP commit, without touching the
+     * working directory. The new commit has the same tree as the head of the chain and the base as its first parent,
+     * keeping any merge parents from the chain so that ongoing merges are preserved.
+     * A chain is only squashed if following first parents from its head reaches the base within WIP_CHAIN_LIMIT
+     * commits; otherwise it isn't a WIP chain at all.
+     *
+     * @param repo The repository.
+     * @param wip The head of the WIP chain.
+     * @param base The target of the base branch, which must not be null.
+     * @return The squashed commit, or a null OID if the WIP could not be squashed.
+     */
+    OID squash_wip_chain(const Repository& repo, const OID& wip, const OID& base) {
+        const Commit head = repo.lookup_commit(wip);
+        vector<Commit> parents;
+        Commit pointer = head;
+        for (int i = 0; i < WIP_CHAIN_LIMIT && pointer.parentcount() > 0; i++) {
+            // Merge parents are kept, newest first.
+            vector<Commit> ps = pointer.parents();
+            parents.insert(parents.end(), ps.begin() + 1, ps.end());
+
+            pointer = pointer.parent(0);
+            if (pointer.id() == base) {
+                parents.insert(parents.begin(), pointer);
+                // Use the same message format as commit_wip().
+                string message = "WIP";
+                if (parents.size() == 2) {
+                    message += "\n" + default_merge_message(parents.at(1).id().str());
+                } else if (parents.size() > 2) {
+                    message += "\n" + default_merge_message("Octopus Merge");
+                }
+                return repo.create_commit("", head.author(), head.committer(), "UTF-8", message, head.tree(), parents);
+            }
+        }
+        return OID();
+    }
+
+    /**
+     * Squash each local WIP branch that consists of a chain of WIP commits, rather than a single commit
+     * on top of its base branch. Such branches are not valid WIP branches and would not otherwise be synced.
+     * Squashing them at the object level means a single WIP commit is pushed, rather than the whole chain.
+     *
+     * @param repo The repository.
+     * @param branchTargets The targets for each branch, before WIP commits have been hashed.
+     *        The local WIP targets are updated to the squashed commits.
+     * @param batch The batch to add the WIP branch changes to.
+     */
+    void squash_wip_chains(const Repository& repo, BranchTargets& branchTargets, RefBatch& batch) {
+        for (auto& entry : branchTargets) {
+            DualTarget& local = entry.second.local;
+            if (!local.hasWip || local.base.isNull) {
+                continue;
+            }
+            const Commit wip = repo.lookup_commit(local.head);
+            if (wip.parentcount() == 0 || wip.parentID(0) == local.base) {
+                continue;
+            }
+
+            const OID squashed = squash_wip_chain(repo, local.head, local.base);
+            if (!squashed.isNull) {
+                batch.set_target(to_wip(entry.first), squashed);
+                local.head = squashed;
+                cout << "Squashed the WIP commits of " << entry.first << "." << endl;
+            }
+        }
+    }
+
+    /**
+     * Refspec to push the specified branch, deleting the remote branch if requested.
+     *
+     * @param branchName Name of the branch to make push.
+     * @param deleting Whether the remote branch should be deleted.
+     * @param wipNamespace The WIP namespace from get_wip_namespace(), or an empty string.
+     * @return The final created refspec.
+     */
+    string make_push_refspec(const string& branchName, bool deleting, const string& wipNamespace) {
+        if (deleting) {
+            return ":" + remote_ref_name(branchName, wipNamespace);
+        } else {
+            return "+refs/heads/" + branchName + ":" + remote_ref_name(branchName, wipNamespace);
+        }
+    }
+
+    /**
+     * Refspecs to fetch the branches matching a pattern, along with their WIP branches.
+     * With a WIP namespace set, WIP branches are fetched from that namespace into its tracking refs.
+     *
+     * @param only Pattern matching the branches to fetch, as accepted by matches_branch_pattern().
+     *        An empty pattern yields no refspecs, so that the remote's configured refspecs are used.
+     * @param wipNamespace The WIP namespace from get_wip_namespace(), or an empty string.
+     * @return The refspecs to fetch.
+     */
+    vector<string> make_fetch_refspecs(const string& only, const string& wipNamespace) {
+        vector<string> refspecs;
+        if (wipNamespace.empty()) {
+            if (!only.empty()) {
+                // A '*' at the end of the pattern also matches the WIP suffix, so one refspec covers both.
+                refspecs.push_back("+refs/heads/" + only + ":refs/remotes/origin/" + only);
+                if (only.back() != '*') {
+                    refspecs.push_back("+refs/heads/" + to_wip(only) + ":refs/remotes/origin/" + to_wip(only));
+                }
+            }
+        } else {
+            const string pattern = only.empty() ? "*" : only;
+            refspecs.push_back("+refs/heads/" + pattern + ":refs/remotes/origin/" + pattern);
+            refspecs.push_back("+" REMOTE_WIP_PREFIX + wipNamespace + "/" + pattern + ":" TRACKING_WIP_PREFIX + pattern);
+        }
+        return refspecs;
+    }
+
+    /**
+     * Update the refs tracking the user's WIP namespace after a push, as Remote::update_tips()
+     * only updates the refs matching the remote's configured refspecs.
+     *
+     * @param repo The repository.
+     * @param pushRefspecs The refspecs that were pushed, as created by make_push_refspec().
+     * @param wipNamespace The WIP namespace from get_wip_namespace().
+     * @param batch The batch to add the ref changes to.
+     */
+    void update_wip_tracking_refs(const Repository& repo, const vector<string>& pushRefspecs,
+                                  const string& wipNamespace, RefBatch& batch) {
+        const string prefix = REMOTE_WIP_PREFIX + wipNamespace + "/";
+        for (const string& refspec : pushRefspecs) {
+            const size_t colon = refspec.find(':');
+            const string dst = refspec.substr(colon + 1);
+            if (!has_prefix(dst, prefix)) {
+                continue;
+            }
+
+            const string trackingRef = TRACKING_WIP_PREFIX + dst.substr(prefix.size());
+            if (colon == 0) {
+                batch.remove_reference(trackingRef);
+            } else {
+                const string src = refspec.substr(1, colon - 1);  // Skip the leading '+'.
+                batch.set_reference(trackingRef, repo.lookup_reference(src).target());
+            }
+        }
+    }
+
+    /**
+     * Add refspecs for pushing the specified base branch and its WIP branch.
+     * Only pushes each branch if the local and remote targets differ.
+     *
+     * @param branchName Branch to queue up for push.
+     * @param targets Targets to compare to branch.
+     * @param refspecs Refspecs reference to add created refspec to
+     * @param wipNamespace The WIP namespace from get_wip_namespace(), or an empty string.
+     */
+    void queue_push(const string& branchName, const RefTargets& targets, vector<string>& refspecs,
+                    const string& wipNamespace) {
+        if (targets.local.base != targets.remote.base) {
+            refspecs.push_back(make_push_refspec(branchName, targets.local.base.isNull, wipNamespace));
+        }
+
+        // If neither side has a WIP branch, don't try to push it.
+        // If exactly one does, then push; in this case the heads are guaranteed to differ assuming valid WIP branch.
+        // If both have WIP branches only push if the heads differ.
+        if ((targets.local.hasWip || targets.remote.hasWip) && targets.local.head != targets.remote.head) {
+            refspecs.push_back(make_push_refspec(to_wip(branchName), !targets.local.hasWip, wipNamespace));
+        }
+    }
+    
+    /**
+     * Move the specified branch to a new target.
+     * Effectively performs a force pull if the new target is a commit fetched from a remote.
+     * Can create and delete branches as needed.
+     *
+     * @param repo The repo to change the branch target within.
+     * @param branchName The branch to move to a new target.
+     * @param newTarget The new target the branch is moved to.
+     * @param head The current head of the repo.
+     * @param batch The batch to add the change to.
+     */
+    void change_branch_target(const Repository& repo, const string& branchName, const OID& newTarget,
+            const Head& head, RefBatch& batch) {
+        bool onBranch = !head.detached && head.name == branchName;
+        if (newTarget.isNull) {
+            // Deleting the current branch switches to another one, which must be done once that branch is up to date.
+            if (onBranch) {
+                batch.delete_after(branchName);
+            } else {
+                // If this was a WIP branch it might already have been deleted when the base branch was deleted.
+                batch.remove(branchName);
+            }
         } else {
-            repo.create_reference("refs/heads/" + branchName, newTarget, true);
             // Update the working dir if this is the current branch.
-            if (is_on_branch(repo, branchName)) {
-                checkout(repo, branchName);
+            // Only the paths that changed between the old and new trees need checking out.
+            if (onBranch) {
+                Tree oldTree;
+                if (branch_exists(repo, branchName)) {
+                    oldTree = repo.lookup_commit(repo.lookup_branch(branchName, GIT_BRANCH_LOCAL).target()).tree();
+                }
+                batch.checkout_after(oldTree, repo.lookup_commit(newTarget).tree());
             }
+
+            batch.set_target(branchName, newTarget);
         }
     }
 
@@ -361,17 +1028,21 @@ namespace metro {
      * @param targets Targets to use use during pull.
      * @param wipCommits A mapping from WIP hashes (generated by wip_commit_hash())
      *        to the OID of a WIP commit with that hash.
+     * @param head The current head of the repo.
+     * @param batch The batch to add the ref changes to.
      */
-    void pull(const Repository& repo, const string& branchName, const RefTargets& targets, map<OID, OID>& wipCommits) {
+    void pull(const Repository& repo, const string& branchName, const RefTargets& targets,
+            unordered_map<OID, OID>& wipCommits, const Head& head, RefBatch& batch) {
         if (targets.local.base != targets.remote.base) {
-            change_branch_target(repo, branchName, targets.remote.base);
+            change_branch_target(repo, branchName, targets.remote.base, head, batch);
         }
 
         // If neither side has a WIP branch, don't try to pull it.
         // If exactly one does, then pull; in this case the heads are guaranteed to differ assuming valid WIP branch.
         // If both have WIP branches only pull if the heads differ.
         if ((targets.local.hasWip || targets.remote.hasWip) && targets.local.head != targets.remote.head) {
-            change_branch_target(repo, to_wip(branchName), targets.remote.hasWip? wipCommits[targets.remote.head] : OID());
+            change_branch_target(repo, to_wip(branchName), targets.remote.hasWip? wipCommits[targets.remote.head] : OID(),
+                                 head, batch);
         }
     }
 
@@ -385,44 +1056,48 @@ namespace metro {
      * @param localTarget The local branch OID.
      * @param remoteTarget The remote branch OID.
      * @param direction The direction syncing is occurring.
-     * @param branchTargets The local, remote and synced targets for each branch.
-     * @param conflictBranchNames The list of existing conflict branch names.
+     * @param conflictVersions The greatest version number in use with each base name, from get_conflict_versions().
      * @param pushRefspecs List of refspecs to push.
      * @param syncedBranches List of branches which have been synced.
      * @param wipCommits A mapping from WIP hashes (generated by wip_commit_hash())
      *        to the OID of a WIP commit with that hash.
+     * @param head The current head of the repo, which is updated if it is moved to the new branch.
+     * @param batch The batch to add the ref changes to.
+     * @param wipNamespace The WIP namespace from get_wip_namespace(), or an empty string.
      */
     void create_conflict_branches(const Repository& repo, const Remote& remote, const string& name,
-            const RefTargets& targets, const SyncDirection& direction, const map<string, RefTargets>& branchTargets,
-            vector<string>& pushRefspecs, vector<string>& syncedBranches, map<OID, OID>& wipCommits) {
+            const RefTargets& targets, const SyncDirection& direction, unordered_map<string, int>& conflictVersions,
+            vector<string>& pushRefspecs, vector<string>& syncedBranches, unordered_map<OID, OID>& wipCommits,
+            Head& head, RefBatch& batch, const string& wipNamespace) {
         assert(direction != UP);  // Should never try to sync conflicting branches with --push
 
         // Generate the new branch name.
-        string newName = next_conflict_branch_name(name, branchTargets);
+        string newName = next_conflict_branch_name(name, conflictVersions);
 
-        repo.create_reference("refs/heads/" + newName, targets.local.base, false);
+        batch.set_target(newName, targets.local.base);
         if (targets.local.hasWip) {
-            repo.create_reference("refs/heads/" + to_wip(newName), wipCommits[targets.local.head], false);
+            batch.set_target(to_wip(newName), wipCommits[targets.local.head]);
         }
 
         cout << "Branch " << name << " had remote changes that conflicted with yours; your commits have been moved to " << newName << "." << endl;
         // If this is the current branch, move the head to the new branch
         // so the user stays on their version of the branch.
         // We don't need to checkout as the contents will not have changed.
-        if (is_on_branch(repo, name)) {
-            move_head(repo, newName);
+        if (!head.detached && head.name == name) {
+            batch.set_head(newName);
+            head = Head(newName, false);
             cout << "You've been moved to " << newName << "." << endl;
         }
 
         // Pull the remote branch under the original branch name.
-        pull(repo, name, targets, wipCommits);
+        pull(repo, name, targets, wipCommits, head, batch);
         syncedBranches.push_back(name);
         syncedBranches.push_back(to_wip(name));
 
         if (direction != DOWN) {
-            pushRefspecs.push_back(make_push_refspec(newName, false));
+            pushRefspecs.push_back(make_push_refspec(newName, false, wipNamespace));
             if (targets.local.hasWip) {
-                pushRefspecs.push_back(make_push_refspec(to_wip(newName), false));
+                pushRefspecs.push_back(make_push_refspec(to_wip(newName), false, wipNamespace));
             }
 
             syncedBranches.push_back(newName);
@@ -430,6 +1105,233 @@ namespace metro {
         }
     }
 
+    /**
+     * Decide which way a branch with differing local and remote heads should be synced.
+     * Both the local and remote targets are assumed to be valid.
+     *
+     * If both sides have changed since the last sync but the head of one is an ancestor of the other,
+     * the branch is pushed or pulled rather than treated as a conflict, and diverged is set to true.
+     *
+     * @param repo The repository.
+     * @param targets The local, remote and synced targets of the branch.
+     * @param diverged Set to true if both sides changed but one could still be fast-forwarded.
+     * @return The type of sync the branch needs.
+     */
+    SyncType get_sync_type(const Repository& repo, const RefTargets& targets, bool& diverged) {
+        diverged = false;
+        if (targets.local.head == targets.synced.head) {
+            // Only remote has changed so pull.
+            return PULL;
+        } else if (targets.remote.head == targets.synced.head) {
+            // Only local has changed so push.
+            return PUSH;
+        }
+
+        // Both sides have changed since last sync, so check whether the head of one
+        // is an ancestor of the other. In this case, rather than making a new conflict branch that contains
+        // no commits since the divergence point, just retain all the commits on both sides.
+        // Find the most recent common ancestor. Will default to null if they have none in common,
+        // or one of the branches does not exist.
+        OID base;
+        if (!(targets.local.head.isNull || targets.remote.head.isNull)) {
+            try {
+                base = repo.merge_base(targets.local.head, targets.remote.head);
+            } catch (GitException& ex) {
+                // If there is no base at all, keep it as null.
+            }
+        }
+
+        if (targets.local.head == base) {
+            // Remote has more commits so pull.
+            diverged = true;
+            return PULL;
+        } else if (targets.remote.head == base) {
+            // Local has more commits so push.
+            diverged = true;
+            return PUSH;
+        } else {
+            // Neither side is an ancestor of the other so a new conflict branch must be made.
+            return CONFLICT;
+        }
+    }
+
+    /**
+     * Checks whether syncing a branch will move its local targets to the remote ones.
+     *
+     * @param repo The repository.
+     * @param targets The local, remote and synced targets of the branch.
+     * @param direction The direction syncing is occurring.
+     * @param wipCommits A mapping from WIP hashes (generated by wip_commit_hash())
+     *        to the OID of a WIP commit with that hash.
+     * @return True if the branch will be pulled.
+     */
+    bool will_pull(const Repository& repo, const RefTargets& targets, SyncDirection direction,
+            unordered_map<OID, OID>& wipCommits) {
+        if (direction == UP || targets.local.head == targets.remote.head) {
+            return false;
+        }
+        if (!(targets.local.is_valid(repo, wipCommits) && targets.remote.is_valid(repo, wipCommits))) {
+            return false;
+        }
+        bool diverged;
+        return get_sync_type(repo, targets, diverged) == PULL;
+    }
+
+    /**
+     * Decide how to sync a single branch whose local and remote heads differ.
+     *
+     * @param repo The repository.
+     * @param targets The local, remote and synced targets of the branch.
+     * @param wipCommits A mapping from WIP hashes (generated by wip_commit_hash())
+     *        to the OID of a WIP commit with that hash.
+     * @return The plan for the branch.
+     */
+    BranchPlan plan_branch(const Repository& repo, const RefTargets& targets, const unordered_map<OID, OID>& wipCommits) {
+        BranchPlan plan;
+        plan.localValid = targets.local.is_valid(repo, wipCommits);
+        plan.remoteValid = targets.remote.is_valid(repo, wipCommits);
+        if (plan.localValid && plan.remoteValid) {
+            plan.type = get_sync_type(repo, targets, plan.diverged);
+        }
+        return plan;
+    }
+
+    /**
+     * Decide how to sync each of the given branches whose local and remote heads differ.
+     * Branches are planned in parallel, each thread using its own handle to the repository
+     * as libgit2 repository handles must not be shared between threads.
+     * Planning does not modify the repository, so the result is the same as planning serially.
+     *
+     * @param repo The repository.
+     * @param branches The branches to plan, sorted by name.
+     * @param wipCommits A mapping from WIP hashes (generated by wip_commit_hash())
+     *        to the OID of a WIP commit with that hash.
+     * @return The plan for each branch, in the same order as branches.
+     *         Branches whose local and remote heads are the same get a default plan.
+     */
+    vector<BranchPlan> plan_branches(const Repository& repo, const vector<const BranchTargets::value_type*>& branches,
+                                     const unordered_map<OID, OID>& wipCommits) {
+        vector<BranchPlan> plans(branches.size());
+        vector<size_t> toPlan;
+        for (size_t i = 0; i < branches.size(); i++) {
+            const RefTargets& targets = branches[i]->second;
+            if (targets.local.head != targets.remote.head) {
+                toPlan.push_back(i);
+            }
+        }
+
+        // Starting threads and opening repository handles isn't worth it for a few branches.
+        size_t threadCount = min((size_t) thread::hardware_concurrency(), toPlan.size() / SYNC_PLAN_BRANCHES_PER_THREAD);
+        if (threadCount <= 1) {
+            for (size_t i : toPlan) {
+                plans[i] = plan_branch(repo, branches[i]->second, wipCommits);
+            }
+            return plans;
+        }
+
+        // Each thread takes the next unplanned branch until none are left.
+        atomic<size_t> nextBranch(0);
+        vector<exception_ptr> errors(threadCount);
+        vector<thread> threads;
+        for (size_t t = 0; t < threadCount; t++) {
+            threads.emplace_back([&, t]() {
+                try {
+                    Repository threadRepo = Repository::open(repo.path());
+                    for (size_t n = nextBranch++; n < toPlan.size(); n = nextBranch++) {
+                        size_t i = toPlan[n];
+                        plans[i] = plan_branch(threadRepo, branches[i]->second, wipCommits);
+                    }
+                } catch (...) {
+                    errors[t] = current_exception();
+                    // Stop the other threads early.
+                    nextBranch = toPlan.size();
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+
+        for (const auto& error : errors) {
+            if (error) {
+                rethrow_exception(error);
+            }
+        }
+        return plans;
+    }
+
+    /**
+     * Checks whether the remote branches advertised when connecting match the remote-tracking branches
+     * left by the last fetch, in which case fetching would not change anything.
+     *
+     * @param advertised The references advertised by the remote, as returned by Remote::ls().
+     * @param branchTargets The targets for each branch being synced, before WIP commits have been hashed.
+     * @param only Pattern matching the branches being synced, as accepted by matches_branch_pattern().
+     * @param except Name of a branch that is not being synced, or an empty string.
+     * @param wipNamespace The WIP namespace from get_wip_namespace(), or an empty string.
+     * @return True if the remote has not changed since the last fetch.
+     */
+    bool remote_unchanged(const map<string, OID>& advertised, const BranchTargets& branchTargets, const string& only,
+                          const string& except, const string& wipNamespace) {
+        unordered_map<string, OID> remoteBranches;
+        for (const auto& entry : advertised) {
+            string name = advertised_branch_name(entry.first, wipNamespace);
+            if (!name.empty() && matches_branch_pattern(only, un_wip(name)) && un_wip(name) != except) {
+                remoteBranches[name] = entry.second;
+            }
+        }
+
+        unordered_map<string, OID> trackedBranches;
+        for (const auto& entry : branchTargets) {
+            const DualTarget& remote = entry.second.remote;
+            if (!remote.base.isNull) {
+                trackedBranches[entry.first] = remote.base;
+            }
+            if (remote.hasWip) {
+                trackedBranches[to_wip(entry.first)] = remote.head;
+            }
+        }
+        return remoteBranches == trackedBranches;
+    }
+
+    /**
+     * Checks whether every branch has the same local, remote and synced targets,
+     * in which case syncing would not change anything.
+     *
+     * @param branchTargets The targets for each branch, with WIP commits replaced by their hashes.
+     * @return True if all branches are already synced.
+     */
+    bool all_synced(const BranchTargets& branchTargets) {
+        for (const auto& entry : branchTargets) {
+            const RefTargets& targets = entry.second;
+            if (targets.local.head != targets.remote.head || targets.local.base != targets.remote.base
+                    || targets.local.head != targets.synced.head || targets.local.base != targets.synced.base) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Restore the WIP of the current branch to the working directory once a sync has finished.
+     *
+     * @param repo The repository.
+     * @param wipInWorkdir Whether the WIP was committed without being removed from the working directory.
+     */
+    void finish_wip(const Repository& repo, bool wipInWorkdir) {
+        const Head head = get_head(repo);
+        const string wipName = to_wip(head.name);
+        if (wipInWorkdir) {
+            // Nothing has been checked out over the WIP changes, so the working directory already matches
+            // the WIP branch (which may have been moved to a conflict branch) and it can just be dropped.
+            if (branch_exists(repo, wipName)) {
+                delete_branch(repo, wipName);
+            }
+        } else if (!head.detached && branch_exists(repo, wipName)) {
+            restore_wip(repo, false);
+        }
+    }
+
     /**
      * Callback for push transfer.
      */
@@ -442,6 +1344,263 @@ namespace metro {
         return GIT_OK;
     }
 
+    /**
+     * Get the mirror remotes listed in the metro.mirror config variable.
+     *
+     * @param repo The repository.
+     * @return The names of the mirror remotes, in the order they are listed.
+     */
+    vector<string> get_mirrors(const Repository& repo) {
+        vector<string> mirrors;
+        try {
+            repo.config().get_multivar_foreach(MIRROR_CONFIG, [](const git_config_entry *entry, void *payload) {
+                auto mirrors = static_cast<vector<string> *>(payload);
+                // Origin is always pushed to anyway.
+                if (strcmp(entry->value, "origin") != 0) {
+                    mirrors->push_back(entry->value);
+                }
+                return 0;
+            }, &mirrors);
+        } catch (GitException&) {
+            // No mirrors are configured.
+        }
+        return mirrors;
+    }
+
+    /**
+     * Get the configured mirrors that missed changes in an earlier sync, as recorded by update_mirrors_behind().
+     *
+     * @param repo The repository.
+     * @return The names of the mirrors that need catching up with origin.
+     */
+    vector<string> mirrors_behind(const Repository& repo) {
+        string contents;
+        try {
+            contents = read_all(repo.path() + MIRRORS_BEHIND_FILE);
+        } catch (MetroException&) {
+            return {};
+        }
+        istringstream lines(contents);
+        unordered_set<string> behind;
+        for (string line; getline(lines, line);) {
+            behind.insert(line);
+        }
+        // Mirrors that have since been removed from the config don't need catching up.
+        vector<string> mirrors = get_mirrors(repo);
+        mirrors.erase(remove_if(mirrors.begin(), mirrors.end(), [&behind](const string& mirror) {
+            return behind.find(mirror) == behind.end();
+        }), mirrors.end());
+        return mirrors;
+    }
+
+    // The outcome of pushing to a mirror.
+    struct MirrorPush {
+        string name;                // Name of the mirror remote
+        size_t refs = 0;            // Number of refs that differed from origin and were pushed
+        size_t bytes = 0;           // Number of bytes pushed
+        vector<string> rejected;    // Refs the mirror rejected, with the reasons
+        string error;               // Error that stopped the push, or empty if it succeeded
+    };
+
+    /**
+     * Record which mirrors are behind origin after pushing to them, so that later syncs catch them up
+     * even if nothing else has changed.
+     *
+     * @param repo The repository.
+     * @param results The outcome of each push.
+     * @param fullScope Whether the pushes covered every branch synced by default, so that a mirror
+     *        pushed to successfully is completely caught up.
+     */
+    void update_mirrors_behind(const Repository& repo, const vector<MirrorPush>& results, bool fullScope) {
+        FileLock lock(repo.path() + MIRRORS_BEHIND_FILE);
+        const vector<string> previous = mirrors_behind(repo);
+        unordered_set<string> behind(previous.begin(), previous.end());
+        for (const MirrorPush& result : results) {
+            if (!result.error.empty() || !result.rejected.empty()) {
+                behind.insert(result.name);
+            } else if (fullScope) {
+                behind.erase(result.name);
+            }
+        }
+        if (behind == unordered_set<string>(previous.begin(), previous.end())) {
+            return;
+        }
+        string contents;
+        for (const string& mirror : behind) {
+            contents += mirror + "\n";
+        }
+        lock.commit(contents);
+    }
+
+    /**
+     * Work out the refspecs that bring a mirror's copy of the synced branches in line with origin,
+     * as recorded by the remote-tracking refs after fetching from and pushing to origin.
+     * Branches outside the pattern are left alone, as their remote-tracking refs may be out of date.
+     *
+     * @param repo The repository.
+     * @param mirrorRefs The references advertised by the mirror, as returned by Remote::ls().
+     * @param only Pattern matching the branches synced, as accepted by matches_branch_pattern().
+     * @param wipNamespace The WIP namespace from get_wip_namespace(), or an empty string.
+     * @return The refspecs to push to the mirror.
+     */
+    vector<string> make_mirror_refspecs(const Repository& repo, const map<string, OID>& mirrorRefs,
+                                        const string& only, const string& wipNamespace) {
+        // Map from the name of each ref on origin to the remote-tracking ref holding its target.
+        struct TrackingPayload {
+            map<string, pair<string, OID>> *tracking;
+            const string *only;
+            const string *wipNamespace;
+        };
+        map<string, pair<string, OID>> tracking;
+        TrackingPayload payload{&tracking, &only, &wipNamespace};
+        repo.foreach_reference([](const Branch& ref, const void *payload) {
+            auto trackingPayload = (const TrackingPayload *) payload;
+            const string& wipNamespace = *trackingPayload->wipNamespace;
+            if (ref.type() != GIT_REFERENCE_DIRECT) {
+                return 0;
+            }
+            const string refName = ref.reference_name();
+            string name, remoteRef;
+            if (has_prefix(refName, "refs/remotes/origin/")) {
+                name = refName.substr(strlen("refs/remotes/origin/"));
+                // Other users' WIP branches are ignored when WIP branches are kept in a namespace.
+                if (!wipNamespace.empty() && is_wip(name)) {
+                    return 0;
+                }
+                remoteRef = "refs/heads/" + name;
+            } else if (!wipNamespace.empty() && has_prefix(refName, TRACKING_WIP_PREFIX)) {
+                name = to_wip(refName.substr(strlen(TRACKING_WIP_PREFIX)));
+                remoteRef = remote_ref_name(name, wipNamespace);
+            }
+            if (!remoteRef.empty() && matches_branch_pattern(*trackingPayload->only, un_wip(name))) {
+                (*trackingPayload->tracking)[remoteRef] = make_pair(refName, ref.target());
+            }
+            return 0;
+        }, &payload);
+
+        vector<string> refspecs;
+        for (const auto& entry : tracking) {
+            const auto mirrorRef = mirrorRefs.find(entry.first);
+            if (mirrorRef == mirrorRefs.end() || mirrorRef->second != entry.second.second) {
+                refspecs.push_back("+" + entry.second.first + ":" + entry.first);
+            }
+        }
+        for (const auto& entry : mirrorRefs) {
+            const string name = advertised_branch_name(entry.first, wipNamespace);
+            if (!name.empty() && matches_branch_pattern(only, un_wip(name))
+                    && tracking.find(entry.first) == tracking.end()) {
+                refspecs.push_back(":" + entry.first);
+            }
+        }
+        return refspecs;
+    }
+
+    // Payload for the callbacks used when pushing to a mirror.
+    struct MirrorPayload : public CredentialPayload {
+        MirrorPush *result;
+    };
+
+    /**
+     * Bring a mirror's copy of the synced branches in line with origin, as found by make_mirror_refspecs(),
+     * recording the outcome rather than throwing.
+     * Safe to run on its own thread, as the repository is opened again.
+     * The user is never prompted for credentials; the ones given are tried, then any credential helpers.
+     *
+     * @param path Path of the repository.
+     * @param only Pattern matching the branches synced, as accepted by matches_branch_pattern().
+     * @param wipNamespace The WIP namespace from get_wip_namespace(), or an empty string.
+     * @param credentials Credentials to try first, such as those used for origin.
+     * @param result The outcome of the push, whose name is the mirror to push to.
+     */
+    void push_to_mirror(const string& path, const string& only, const string& wipNamespace,
+                        const CredentialStore& credentials, MirrorPush& result) {
+        try {
+            Repository repo = Repository::open(path);
+            Remote remote = repo.lookup_remote(result.name);
+
+            CredentialStore mirrorCredentials = credentials;
+            mirrorCredentials.tried = false;
+            MirrorPayload payload{{&mirrorCredentials, &repo, false}, &result};
+
+            git_remote_callbacks callbacks = GIT_REMOTE_CALLBACKS_INIT;
+            callbacks.credentials = acquire_credentials;
+            // All callbacks share the payload, which acquire_credentials() expects to be a CredentialPayload.
+            callbacks.payload = static_cast<CredentialPayload *>(&payload);
+            callbacks.push_transfer_progress = [](unsigned int current, unsigned int total, size_t bytes, void *payload) {
+                static_cast<MirrorPayload *>(static_cast<CredentialPayload *>(payload))->result->bytes = bytes;
+                return 0;
+            };
+            callbacks.push_update_reference = [](const char *refname, const char *status, void *payload) {
+                if (status != nullptr) {
+                    static_cast<MirrorPayload *>(static_cast<CredentialPayload *>(payload))->result->rejected
+                            .push_back(string(refname) + " (" + status + ")");
+                }
+                return 0;
+            };
+
+            // Compare against what the mirror actually has, so a mirror that missed earlier pushes catches up.
+            remote.connect(GIT_DIRECTION_PUSH, callbacks);
+            const map<string, OID> mirrorRefs = remote.ls();
+            remote.disconnect();
+            const vector<string> refspecs = make_mirror_refspecs(repo, mirrorRefs, only, wipNamespace);
+            result.refs = refspecs.size();
+            if (refspecs.empty()) {
+                return;
+            }
+
+            git_push_options options = GIT_PUSH_OPTIONS_INIT;
+            options.callbacks = callbacks;
+            mirrorCredentials.tried = false;
+            remote.push(StrArray(refspecs), options);
+        } catch (exception& e) {
+            result.error = e.what();
+        }
+    }
+
+    /**
+     * Push to each of the given mirrors with push_to_mirror(), each on its own thread and connection.
+     *
+     * @param repo The repository.
+     * @param mirrorPushes The mirrors to push to, which receive the outcome of each push.
+     * @param credentials Credentials to try first, such as those used for origin.
+     * @param only Pattern matching the branches synced, as accepted by matches_branch_pattern().
+     * @param wipNamespace The WIP namespace from get_wip_namespace(), or an empty string.
+     */
+    void push_to_mirrors(const Repository& repo, vector<MirrorPush>& mirrorPushes, const CredentialStore& credentials,
+                         const string& only, const string& wipNamespace) {
+        vector<thread> mirrorThreads;
+        for (MirrorPush& mirrorPush : mirrorPushes) {
+            cout << "Pushing to " << mirrorPush.name << "..." << endl;
+            mirrorThreads.emplace_back(push_to_mirror, repo.path(), cref(only), cref(wipNamespace), cref(credentials),
+                                       ref(mirrorPush));
+        }
+        for (auto& t : mirrorThreads) {
+            t.join();
+        }
+    }
+
+    /**
+     * Report the outcome of pushing to each mirror.
+     *
+     * @param results The outcome of each push.
+     */
+    void report_mirror_pushes(const vector<MirrorPush>& results) {
+        for (const MirrorPush& result : results) {
+            if (!result.error.empty()) {
+                cout << "Couldn't push to " << result.name << ": " << result.error << endl;
+            } else if (result.refs == 0) {
+                cout << result.name << " is already up to date." << endl;
+            } else if (!result.rejected.empty()) {
+                cout << result.name << " rejected some pushes:" << endl;
+                for (const string& rejection : result.rejected) {
+                    cout << "    " << rejection << endl;
+                }
+            } else {
+                cout << "Pushed " << result.bytes << " bytes to " << result.name << "." << endl;
+            }
+        }
+    }
+
     /**
      * Callback for fetch transfer.
      */
@@ -458,10 +1617,189 @@ namespace metro {
     }
 
 
-    Repository clone(const string& url, const string& path) {
+    /**
+     * Create a remote that only fetches the given branch and its WIP branch, like git clone --single-branch.
+     *
+     * @param repo The repository to create the remote in.
+     * @param name Name of the remote.
+     * @param url Url of the remote.
+     * @param branch The branch to fetch.
+     * @return The new remote.
+     */
+    Remote create_single_branch_remote(const Repository& repo, const string& name, const string& url,
+                                       const string& branch) {
+        const string wipBranch = to_wip(branch);
+        const string prefix = "refs/remotes/" + name + "/";
+        Remote created = repo.remote_create_with_fetchspec(name, url, "+refs/heads/" + branch + ":" + prefix + branch);
+        return repo.remote_add_fetch(name, "+refs/heads/" + wipBranch + ":" + prefix + wipBranch);
+    }
+
+    /**
+     * Create a remote with create_single_branch_remote() when cloning.
+     * This has the signature of a git_remote_create_cb.
+     *
+     * @param out Output for the new remote.
+     * @param repo The repository to create the remote in.
+     * @param name Name of the remote.
+     * @param url Url of the remote.
+     * @param payload Pointer to the name of the branch, as a const string.
+     * @return 0 on success, or a libgit2 error code.
+     */
+    int create_single_branch_remote_cb(git_remote **out, git_repository *repo, const char *name, const char *url,
+                                       void *payload) {
+        const string& branch = *static_cast<const string *>(payload);
+        try {
+            Remote remote = create_single_branch_remote(Repository::borrow(repo), name, url, branch);
+        } catch (GitException& e) {
+            return e.code();
+        }
+        // libgit2 takes ownership of the output, so it needs a remote of its own.
+        return git_remote_lookup(out, repo, name);
+    }
+
+    /**
+     * Get the path of the mirror of a remote in a clone cache directory.
+     * Mirrors are named after a hash of the url, so each remote gets its own.
+     *
+     * @param url Url of the remote.
+     * @param cacheDir The clone cache directory.
+     * @return The absolute path of the mirror.
+     */
+    string cache_mirror_path(const string& url, const string& cacheDir) {
+        git_oid urlHash;
+        int err = git_odb_hash(&urlHash, url.c_str(), url.size(), GIT_OBJECT_BLOB);
+        check_error(err);
+        // Alternates must be absolute paths, so the mirror must be too.
+        return (std::filesystem::absolute(cacheDir) / (OID(urlHash).str() + ".git")).string();
+    }
+
+    /**
+     * Create the bare mirror of a remote in a clone cache directory if it doesn't exist yet,
+     * then fetch into it, only downloading the objects it is missing.
+     * The mirror's HEAD is pointed at the remote's default branch.
+     * The caller must hold the mirror's lock, as taken by clone_through_cache().
+     *
+     * @param url Url of the remote.
+     * @param mirrorPath Path of the mirror, from cache_mirror_path().
+     * @param fetchOpts The options to fetch with.
+     * @return The up to date mirror.
+     */
+    Repository update_cache_mirror(const string& url, const string& mirrorPath, const git_fetch_options& fetchOpts) {
+        if (!Repository::exists(mirrorPath)) {
+            Repository mirror = Repository::init(mirrorPath, true);
+            // Mirror the branches and every WIP namespace, so any clone can be made from the mirror.
+            Remote created = mirror.remote_create_with_fetchspec("origin", url, "+refs/heads/*:refs/heads/*");
+            Remote updated = mirror.remote_add_fetch("origin", "+" REMOTE_WIP_PREFIX "*:" REMOTE_WIP_PREFIX "*");
+        }
+
+        Repository mirror = Repository::open(mirrorPath);
+        Remote origin = mirror.lookup_remote("origin");
+        cout << "Updating cached copy of " << url << "..." << endl;
+        origin.connect(GIT_DIRECTION_FETCH, fetchOpts.callbacks);
+        try {
+            mirror.set_head(origin.default_branch());
+        } catch (GitException&) {
+            // The remote is empty, so leave HEAD at its default.
+        }
+        origin.download(StrArray(vector<string>()), fetchOpts);
+        origin.update_tips(fetchOpts.callbacks, false, GIT_REMOTE_DOWNLOAD_TAGS_UNSPECIFIED);
+        origin.prune(fetchOpts.callbacks);
+        origin.disconnect();
+        clear_progress_bar();
+        return mirror;
+    }
+
+    /**
+     * Create a repository that reads its objects from a clone cache mirror through git alternates,
+     * with remote-tracking refs copied from the mirror's refs as if they had been fetched from the remote.
+     * HEAD is pointed at the branch to check out, but nothing is checked out.
+     *
+     * @param url Url of the remote.
+     * @param repoPath Path to the .git directory of the new repository.
+     * @param mirror The mirror of the remote, from update_cache_mirror().
+     * @param branch If not empty, only this branch and its WIP branch are copied.
+     * @return The new repository.
+     * @throws BranchNotFoundException If branch is not empty and the remote has no such branch.
+     */
+    Repository clone_from_cache(const string& url, const string& repoPath, const Repository& mirror,
+                                const string& branch) {
+        if (!branch.empty() && !branch_exists(mirror, branch)) {
+            throw BranchNotFoundException(branch);
+        }
+
+        Repository::init(repoPath, false);
+        write_all(mirror.path() + "objects\n", repoPath + "/objects/info/alternates");
+        // Reopen the repository so that it picks up the alternates.
+        Repository repo = Repository::open(repoPath);
+
+        Remote origin = branch.empty() ? repo.remote_create("origin", url)
+                                       : create_single_branch_remote(repo, "origin", url, branch);
+
+        // Copy the refs a fetch would have created.
+        struct RefsPayload {
+            vector<pair<string, OID>> *refs;
+        };
+        vector<pair<string, OID>> mirrorRefs;
+        RefsPayload payload{&mirrorRefs};
+        mirror.foreach_reference([](const Branch& ref, const void *payload) {
+            if (ref.type() == GIT_REFERENCE_DIRECT) {
+                ((const RefsPayload *) payload)->refs->emplace_back(ref.reference_name(), ref.target());
+            }
+            return 0;
+        }, &payload);
+
+        const string wipNamespace = get_wip_namespace(repo);
+        const string namespacePrefix = REMOTE_WIP_PREFIX + wipNamespace + "/";
+        RefBatch batch(repo);
+        for (const auto& ref : mirrorRefs) {
+            string trackingRef;
+            if (has_prefix(ref.first, "refs/heads/")) {
+                const string name = ref.first.substr(strlen("refs/heads/"));
+                if (matches_branch_pattern(branch, un_wip(name))) {
+                    trackingRef = "refs/remotes/origin/" + name;
+                }
+            } else if (!wipNamespace.empty() && has_prefix(ref.first, namespacePrefix)) {
+                const string name = ref.first.substr(namespacePrefix.size());
+                if (matches_branch_pattern(branch, name)) {
+                    trackingRef = TRACKING_WIP_PREFIX + name;
+                }
+            }
+            if (!trackingRef.empty()) {
+                batch.set_reference(trackingRef, ref.second);
+            }
+        }
+        batch.commit();
+
+        repo.set_head("refs/heads/" + (branch.empty() ? get_head(mirror).name : branch));
+        return repo;
+    }
+
+    /**
+     * Update the clone cache mirror of a remote and create a repository from it with clone_from_cache().
+     * The mirror is locked throughout, so concurrent clones of the same remote don't fetch into it at once
+     * or copy its refs while they are being updated.
+     *
+     * @param url Url of the remote.
+     * @param repoPath Path to the .git directory of the new repository.
+     * @param cacheDir The clone cache directory.
+     * @param fetchOpts The options to fetch into the mirror with.
+     * @param branch If not empty, only this branch and its WIP branch are copied.
+     * @return The new repository.
+     * @throws BranchNotFoundException If branch is not empty and the remote has no such branch.
+     */
+    Repository clone_through_cache(const string& url, const string& repoPath, const string& cacheDir,
+                                   const git_fetch_options& fetchOpts, const string& branch) {
+        const string mirrorPath = cache_mirror_path(url, cacheDir);
+        std::filesystem::create_directories(cacheDir);
+        // The lock file sits beside the mirror, as the mirror may not exist yet.
+        AdvisoryLock lock(mirrorPath + ".lock");
+        return clone_from_cache(url, repoPath, update_cache_mirror(url, mirrorPath, fetchOpts), branch);
+    }
+
+    Repository clone(const string& url, const string& path, const string& branch, const string& cacheDir) {
         CredentialStore credentials;
         try {
-            Repository repo = clone(url, path, &credentials);
+            Repository repo = clone(url, path, &credentials, branch, cacheDir);
             return repo;
         } catch (GitException &e) {
             string error(e.what());
@@ -477,7 +1815,8 @@ namespace metro {
         }
     }
 
-    Repository clone(const string& url, const string& path, CredentialStore *credentials) {
+    Repository clone(const string& url, const string& path, CredentialStore *credentials, const string& branch,
+                     const string& cacheDir) {
         const string repoPath = path + "/.git";
         if (Repository::exists(repoPath)) {
             throw RepositoryExistsException();
@@ -488,53 +1827,216 @@ namespace metro {
         CredentialPayload payload{credentials, nullptr};
         options.fetch_opts.callbacks.payload = &payload;
         options.fetch_opts.callbacks.transfer_progress = transfer_progress;
+        // Clone local paths and file:// urls by hardlinking the object files instead of generating and indexing a pack.
+        // libgit2 falls back to copying them if the remote is on a different filesystem.
+        // The default only does this for paths, not file:// urls.
+        options.local = GIT_CLONE_LOCAL;
+
+        if (!branch.empty()) {
+            // Like git clone --single-branch, configure origin to only fetch the branch, along with its WIP branch.
+            options.checkout_branch = branch.c_str();
+            options.remote_cb = create_single_branch_remote_cb;
+            options.remote_cb_payload = const_cast<string *>(&branch);
+        }
 
         credentials->tried = false;
         exit_config.started = true;
-        Repository repo = git::Repository::clone(url, repoPath, &options);
-        // Pull all the other branches (which were fetched anyway).
+        Repository repo = cacheDir.empty()
+                ? git::Repository::clone(url, repoPath, &options)
+                : clone_through_cache(url, repoPath, cacheDir, options.fetch_opts, branch);
+        if (!branch.empty()) {
+            // Later syncs are limited to the cloned branch, so they never push over branches that weren't fetched.
+            repo.config().set_string(SYNC_ONLY_CONFIG, branch);
+        }
+        // Cloning only fetches the remote's branches, so the user's WIP namespace must be fetched separately.
+        // Clones from the cache already have it, copied from the mirror.
+        const string wipNamespace = get_wip_namespace(repo);
+        if (!wipNamespace.empty() && cacheDir.empty()) {
+            credentials->tried = false;
+            repo.lookup_remote("origin").fetch(StrArray(make_fetch_refspecs(branch, wipNamespace)),
+                                               options.fetch_opts);
+        }
+        // Only the current branch is pulled; the others are left as implicit branches until they are needed,
+        // so cloning doesn't write a local ref and sync cache entry for every branch on the remote.
         force_pull(repo);
         clear_progress_bar();
         return repo;
     }
 
-    void sync(const Repository& repo, SyncDirection direction, bool force) {
+    void sync(const Repository& repo, SyncDirection direction, bool force, const string& only, bool excludeCurrent) {
         CredentialStore credentials;
-        sync(repo, &credentials, direction, force);
+        sync(repo, &credentials, direction, force, only, excludeCurrent, nullptr);
     }
 
-    void sync(const Repository& repo, CredentialStore *credentials, SyncDirection direction, bool force) {
-        save_wip(repo);
+    /**
+     * Checks whether the branches a sync with excludeCurrent set would cover are already synced,
+     * judging the remote by the refs it advertised to another sync, so that no second connection is needed.
+     *
+     * @param repo The repository.
+     * @param advertised The references advertised by the remote, as returned by Remote::ls().
+     * @param head The current head of the repo.
+     * @param wipNamespace The WIP namespace from get_wip_namespace(), or an empty string.
+     * @param wipHashes Memo used to avoid rehashing WIP commits.
+     * @return True if syncing the other branches would not change anything.
+     */
+    bool rest_synced(const Repository& repo, const map<string, OID>& advertised, const Head& head,
+                     const string& wipNamespace, WipHashMemo& wipHashes) {
+        const string only = get_sync_only(repo);
+        const string except = head.detached ? "" : head.name;
+        BranchTargets branchTargets;
+        get_branch_targets(repo, &branchTargets, wipNamespace);
+        filter_branch_targets(branchTargets, only, except);
+        if (!remote_unchanged(advertised, branchTargets, only, except, wipNamespace)) {
+            return false;
+        }
+
+        remove_implicit_branches(branchTargets, head);
+        unordered_map<OID, OID> wipCommits;
+        hash_wip_commits(repo, branchTargets, wipCommits, wipHashes);
+        return all_synced(branchTargets);
+    }
+
+    /**
+     * Fetch the branches being synced, then push, pull or branch off each one as needed.
+     * This is everything sync() does after saving the WIP of the current branch.
+     *
+     * @param repo The repository.
+     * @param credentials The credentials used for syncing.
+     * @param direction The direction that can be synced.
+     * @param only Pattern matching the branches to sync, as accepted by matches_branch_pattern().
+     * @param except Name of a branch that is not being synced, or an empty string.
+     * @param wipNamespace The WIP namespace from get_wip_namespace(), or an empty string.
+     * @param head The current head of the repo, which is updated if the sync moves it.
+     * @param syncingCurrent Whether the current branch is being synced.
+     * @param wipInWorkdir Whether the WIP was committed without being removed from the working directory.
+     *        Set to false if the working directory is reset to HEAD.
+     * @param restSynced If not null, set to whether the branches a sync with excludeCurrent set would cover
+     *        were already synced before this sync started, as found by rest_synced().
+     */
+    void sync_branches(const Repository& repo, CredentialStore *credentials, SyncDirection direction,
+                       const string& only, const string& except, const string& wipNamespace, Head& head,
+                       bool syncingCurrent, bool& wipInWorkdir, bool *restSynced) {
+        // The same callbacks are used for fetching and pushing.
+        git_remote_callbacks callbacks = GIT_REMOTE_CALLBACKS_INIT;
+        callbacks.credentials = acquire_credentials;
+        // Background syncs have no terminal to ask for credentials with, so they fail rather than retrying forever.
+        CredentialPayload payload = {credentials, &repo, stdin_is_terminal()};
+        callbacks.payload = &payload;
+        callbacks.transfer_progress = transfer_progress;
+        callbacks.push_transfer_progress = push_transfer_progress;
 
         git_fetch_options fetchOpts = GIT_FETCH_OPTIONS_INIT;
-        fetchOpts.prune = GIT_FETCH_PRUNE;
-        fetchOpts.callbacks.credentials = acquire_credentials;
-        CredentialPayload payload = {credentials, &repo};
-        fetchOpts.callbacks.payload = &payload;
-        fetchOpts.callbacks.transfer_progress = transfer_progress;
+        fetchOpts.callbacks = callbacks;
 
         Remote origin = repo.lookup_remote("origin");
         cout << "Syncing with " << git_remote_url(origin.ptr().get()) << "." << endl;
         credentials->tried = false;
-        cout << "Fetching all branches from remote..." << endl;
-        origin.fetch(StrArray(), fetchOpts);
-        clear_progress_bar();
+        origin.connect(GIT_DIRECTION_FETCH, callbacks);
 
-        map<string, RefTargets> branchTargets;
-        get_branch_targets(repo, &branchTargets);
+        BranchTargets branchTargets;
+        get_branch_targets(repo, &branchTargets, wipNamespace);
+        filter_branch_targets(branchTargets, only, except);
+        WipHashMemo wipHashes(repo);
 
         // Replace WIP commit OIDs with the WIP hashes of those commits.
         // This ensures that when we compare WIP commits later irrelevant metadata
         // such as timestamps and authors are ignored.
-        map<OID, OID> wipCommits;
-        hash_wip_commits(repo, branchTargets, wipCommits);
+        unordered_map<OID, OID> wipCommits;
+
+        // If the remote still advertises the branches we last fetched and nothing has moved locally
+        // since the last sync, there is nothing to fetch, pull or push.
+        const map<string, OID> advertised = origin.ls();
+        if (restSynced != nullptr) {
+            *restSynced = rest_synced(repo, advertised, head, wipNamespace, wipHashes);
+        }
+        const bool remoteUnchanged = remote_unchanged(advertised, branchTargets, only, except, wipNamespace);
+        if (remoteUnchanged) {
+            remove_implicit_branches(branchTargets, head);
+            hash_wip_commits(repo, branchTargets, wipCommits, wipHashes);
+            // Mirrors that missed earlier pushes are caught up below, even if nothing else has changed.
+            if (all_synced(branchTargets) && (direction == DOWN || mirrors_behind(repo).empty())) {
+                origin.disconnect();
+                if (!head.detached && syncingCurrent) {
+                    cout << "Branch " << head.name << " is already synced." << endl;
+                }
+                wipHashes.save();
+                if (syncingCurrent) {
+                    finish_wip(repo, wipInWorkdir);
+                }
+                return;
+            }
+        }
+
+        if (remoteUnchanged) {
+            // Everything the remote advertises has already been fetched, for example by a prefetch,
+            // so the branches can be synced straight away.
+            origin.disconnect();
+        } else {
+            // When syncing only some branches, only fetch those branches and their WIP branches.
+            // With a WIP namespace, only the user's own WIP branches are fetched.
+            const vector<string> fetchRefspecs = make_fetch_refspecs(only, wipNamespace);
+
+            // Fetch over the connection opened above, rather than letting Remote::fetch() open its own.
+            if (only.empty()) {
+                cout << "Fetching all branches from remote..." << endl;
+            } else {
+                cout << "Fetching " << only << " from remote..." << endl;
+            }
+            // Pruning only applies to the refspecs being fetched, so other remote-tracking branches are kept.
+            origin.download(StrArray(fetchRefspecs), fetchOpts);
+            origin.update_tips(callbacks, fetchOpts.update_fetchhead, fetchOpts.download_tags);
+            origin.prune(callbacks);
+            origin.disconnect();
+            clear_progress_bar();
+        }
+
+        branchTargets.clear();
+        wipCommits.clear();
+        get_branch_targets(repo, &branchTargets, wipNamespace);
+        // Conflict branches must not reuse the name of any branch, even those not being synced.
+        unordered_map<string, int> conflictVersions = get_conflict_versions(branchTargets, advertised);
+        filter_branch_targets(branchTargets, only, except);
+        remove_implicit_branches(branchTargets, head);
+        // All local ref changes are committed together once every branch has been processed.
+        RefBatch batch(repo);
+        if (!except.empty()) {
+            // The other branches may be synced in the background while the user switches branch,
+            // so hold HEAD until the batch is committed and leave alone whichever branch is now current.
+            // Otherwise pulling it would move it under the checked out files.
+            head = batch.lock_head();
+            if (!head.detached) {
+                branchTargets.erase(head.name);
+            }
+        }
+        if (auto_squash_wip(repo)) {
+            squash_wip_chains(repo, branchTargets, batch);
+        }
+        hash_wip_commits(repo, branchTargets, wipCommits, wipHashes);
+
+        // Pulling the current branch checks out the new commits over the working directory,
+        // so it must match HEAD first.
+        if (wipInWorkdir) {
+            auto current = branchTargets.find(head.name);
+            if (current != branchTargets.end() && will_pull(repo, current->second, direction, wipCommits)) {
+                if (head_exists(repo)) {
+                    reset_head(repo, get_commit(repo, "HEAD"), true);
+                } else {
+                    reset_to_empty(repo);
+                }
+                wipInWorkdir = false;
+            }
+        }
 
         vector<string> pushRefspecs;
         // Branches that are known to have matching targets on remote and local after this sync operation.
         vector<string> syncedBranches;
-        for(const auto& entry : branchTargets) {
-            const string branchName = entry.first;
-            const RefTargets targets = entry.second;
+        // Decide how to sync every branch up front, then apply the plans in order.
+        const vector<const BranchTargets::value_type*> sortedTargets = sorted_branch_targets(branchTargets);
+        const vector<BranchPlan> plans = plan_branches(repo, sortedTargets, wipCommits);
+        for (size_t i = 0; i < sortedTargets.size(); i++) {
+            const string& branchName = sortedTargets[i]->first;
+            const RefTargets& targets = sortedTargets[i]->second;
+            const BranchPlan& plan = plans[i];
 
             if (targets.local.base == targets.remote.base) {
                 syncedBranches.push_back(branchName);
@@ -545,59 +2047,23 @@ namespace metro {
                     syncedBranches.push_back(to_wip(branchName));
                 }
 
-                if (is_on_branch(repo, branchName)) {
+                if (!head.detached && head.name == branchName) {
                     cout << "Branch " << branchName << " is already synced." << endl;
                 }
-            } else if (targets.local.is_valid(repo, wipCommits) && targets.remote.is_valid(repo, wipCommits)) {
-                SyncType syncType;
-
-                if (targets.local.head == targets.synced.head) {
-                    // Only remote has changed so pull.
-                    syncType = PULL;
-                } else if (targets.remote.head == targets.synced.head) {
-                    // Only local has changed so push.
-                    syncType = PUSH;
-                } else {
-                    // Both sides have changed since last sync.
-                    syncType = CONFLICT;
-                }
+            } else if (plan.localValid && plan.remoteValid) {
+                SyncType syncType = plan.type;
 
-                // If the local and remote branches are found to be in conflict, check whether the head of one
-                // is an ancestor of the other. In this case, rather than making a new conflict branch that contains
-                // no commits since the divergence point, just retain all the commits on both sides.
-                if (syncType == CONFLICT) {
-                    // Find the most recent common ancestor. Will default to null if they have none in common,
-                    // or one of the branches does not exist.
-                    OID base;
-                    if (!(targets.local.head.isNull || targets.remote.head.isNull)) {
-                        try {
-                            base = repo.merge_base(targets.local.head, targets.remote.head);
-                        } catch (GitException& ex) {
-                            // If there is no base at all, keep it as null.
-                        }
-                    }
-
-                    if (targets.local.head == base) {
-                        // Remote has more commits so pull.
-                        cout << "Branch " << branchName << " has been modified both locally and remotely, "
-                             << "but in different ways. The local branch has been updated." << endl;
-                        syncType = PULL;
-                    } else if (targets.remote.head == base) {
-                        // Local has more commits so push.
-                        cout << "Branch " << branchName << " has been modified both locally and remotely, "
-                             << "but in different ways. The remote branch has been updated." << endl;
-                        syncType = PUSH;
-                    } else {
-                        // Neither side is an ancestor of the other so a new conflict branch must be made.
-                        syncType = CONFLICT;
-                    }
+                if (plan.diverged) {
+                    cout << "Branch " << branchName << " has been modified both locally and remotely, "
+                         << "but in different ways. The " << (syncType == PULL ? "local" : "remote")
+                         << " branch has been updated." << endl;
                 }
 
                 switch (syncType) {
                     case PUSH:
                         if (direction == UP || direction == BOTH) {
                             cout << "Pushing " << branchName << "..." << endl;
-                            queue_push(branchName, targets, pushRefspecs);
+                            queue_push(branchName, targets, pushRefspecs, wipNamespace);
 
                             syncedBranches.push_back(branchName);
                             syncedBranches.push_back(to_wip(branchName));
@@ -606,7 +2072,7 @@ namespace metro {
                     case PULL:
                         if (direction == DOWN || direction == BOTH) {
                             cout << "Pulling " << branchName << "..." << endl;
-                            pull(repo, branchName, targets, wipCommits);
+                            pull(repo, branchName, targets, wipCommits, head, batch);
 
                             syncedBranches.push_back(branchName);
                             syncedBranches.push_back(to_wip(branchName));
@@ -614,8 +2080,9 @@ namespace metro {
                         break;
                     case CONFLICT:
                         if (direction != UP) {
-                            create_conflict_branches(repo, origin, branchName, targets, direction,
-                                                     branchTargets, pushRefspecs, syncedBranches, wipCommits);
+                            create_conflict_branches(repo, origin, branchName, targets, direction, conflictVersions,
+                                                     pushRefspecs, syncedBranches, wipCommits, head, batch,
+                                                     wipNamespace);
                         } else {
                             cout << "Branch " << branchName << " conflicts with remote, not pushing." << endl;
                         }
@@ -624,49 +2091,330 @@ namespace metro {
             } else {
                 // Don't attempt to sync a broken WIP branch,
                 // as it is hard to tell what the user intended in such a situation.
-                bool localOK = targets.local.is_valid(repo, wipCommits);
-                string side = localOK ? "Remote" : "Local";
+                string side = plan.localValid ? "Remote" : "Local";
                 cout << side << " wip branch for " << branchName << " is not a valid work in progress branch for "
                      << branchName << ", so neither branch can be synced. Delete " << to_wip(branchName)
                      << " to resolve the issue." << endl;
             }
         }
 
+        batch.commit();
+
+        // Mirrors are brought in line with origin whenever something is pushed,
+        // and those that missed earlier pushes are caught up on every sync.
+        vector<MirrorPush> mirrorPushes;
+        if (direction != DOWN) {
+            for (const string& mirror : pushRefspecs.empty() ? mirrors_behind(repo) : get_mirrors(repo)) {
+                mirrorPushes.push_back(MirrorPush{mirror});
+            }
+        }
+
         if (!pushRefspecs.empty()) {
             // Pushes shouldn't be queued in the first place when using --pull.
             assert(direction == UP || direction == BOTH);
 
             git_push_options options = GIT_PUSH_OPTIONS_INIT;
-            options.callbacks.credentials = acquire_credentials;
-            options.callbacks.payload = &payload;
-            options.callbacks.push_transfer_progress = push_transfer_progress;
-
-            credentials->tried = false;
-            origin.push(StrArray(pushRefspecs), options);
+            options.callbacks = callbacks;
+            try {
+                credentials->tried = false;
+                origin.push(StrArray(pushRefspecs), options);
+            } catch (...) {
+                // Origin is the authoritative remote, so mirrors never get changes it hasn't accepted.
+                for (MirrorPush& mirrorPush : mirrorPushes) {
+                    mirrorPush.error = "Nothing was pushed, as the push to origin failed.";
+                }
+                report_mirror_pushes(mirrorPushes);
+                throw;
+            }
+            if (!wipNamespace.empty()) {
+                RefBatch trackingBatch(repo);
+                update_wip_tracking_refs(repo, pushRefspecs, wipNamespace, trackingBatch);
+                trackingBatch.commit();
+            }
             clear_progress_bar();
         }
 
-        update_sync_cache(repo, syncedBranches);
-        restore_wip(repo, false);
+        if (!mirrorPushes.empty()) {
+            // The mirrors get their own copy of the credentials, as each thread may replace them.
+            const CredentialStore mirrorCredentials = *credentials;
+            push_to_mirrors(repo, mirrorPushes, mirrorCredentials, only, wipNamespace);
+            report_mirror_pushes(mirrorPushes);
+            update_mirrors_behind(repo, mirrorPushes, only == get_sync_only(repo));
+        }
+
+        update_sync_cache(repo, syncedBranches, wipHashes);
+        wipHashes.save();
+        if (syncingCurrent) {
+            finish_wip(repo, wipInWorkdir);
+        }
+    }
+
+    void sync(const Repository& repo, CredentialStore *credentials, SyncDirection direction, bool force,
+              const string& requestedOnly, bool excludeCurrent, bool *restSynced) {
+        const string only = requestedOnly.empty() ? get_sync_only(repo) : requestedOnly;
+        if (std::count(only.begin(), only.end(), '*') > 1) {
+            throw UnsupportedOperationException("Branch patterns can contain at most one '*'.");
+        }
+        const string wipNamespace = get_wip_namespace(repo);
+
+        // Resolve HEAD once; it is only moved by the sync itself, which keeps this up to date.
+        // Committing the WIP below doesn't move it.
+        Head head = get_head(repo);
+        const string except = excludeCurrent && !head.detached ? head.name : "";
+        // Syncs of the other branches are the second stage of staged_sync(), which has already reported these.
+        if (requestedOnly.empty() && !excludeCurrent) {
+            report_unsynced_branches(repo, only);
+        }
+        // If the current branch is not being synced, its WIP and the working directory are left alone.
+        const bool syncingCurrent = head.detached || (except.empty() && matches_branch_pattern(only, head.name));
+
+        // Commit any uncommitted changes to the WIP branch, but leave them in the working directory.
+        // The working directory is only reset if the current branch is going to be pulled,
+        // so syncs that don't change the current branch don't touch any files.
+        // Restoring an ongoing merge requires a clean working directory, so in that case reset straight away.
+        bool wipInWorkdir = false;
+        if (syncingCurrent) {
+            if (merge_ongoing(repo)) {
+                save_wip(repo);
+            } else {
+                wipInWorkdir = commit_wip(repo);
+            }
+        }
+
+        try {
+            sync_branches(repo, credentials, direction, only, except, wipNamespace, head, syncingCurrent,
+                          wipInWorkdir, restSynced);
+        } catch (...) {
+            // The WIP changes are still in the working directory, so drop the WIP branch again.
+            // Leaving both behind would stop the next sync, switch or wip save from committing a new WIP.
+            if (wipInWorkdir) {
+                finish_wip(repo, true);
+            }
+            throw;
+        }
+    }
+
+    void staged_sync(const Repository& repo, SyncDirection direction, bool background) {
+        const Head head = get_head(repo);
+        // Mirrors that are behind are only caught up with every branch by a full sync.
+        if (head.detached || !matches_branch_pattern(get_sync_only(repo), head.name)
+                || (direction != DOWN && !mirrors_behind(repo).empty())) {
+            sync(repo, direction, false, "", false);
+            return;
+        }
+
+        report_unsynced_branches(repo, get_sync_only(repo));
+        // Credentials are shared between the stages so that the user is only asked once.
+        CredentialStore credentials;
+        bool restSynced = false;
+        sync(repo, &credentials, direction, false, head.name, false, &restSynced);
+        // If the remote listing showed the other branches are already synced, the second stage can be skipped,
+        // so a sync with nothing to do only connects to the remote once.
+        if (restSynced) {
+            return;
+        }
+        cout << "Branch " << head.name << " is ready." << endl;
+
+        if (background) {
+            string cmd = metro_command() + " sync --rest";
+            if (direction == UP) {
+                cmd += " --push";
+            } else if (direction == DOWN) {
+                cmd += " --pull";
+            }
+            start_background_command(cmd, repo.path() + SYNC_LOG_FILE);
+            cout << "Syncing other branches in the background; see " << repo.path() + SYNC_LOG_FILE
+                 << " for progress." << endl;
+        } else {
+            sync(repo, &credentials, direction, false, "", true, nullptr);
+        }
+    }
+
+    /**
+     * Computes a signature of the paths, sizes and modification times of the files in the working directory,
+     * skipping ignored files, by walking the whole working directory.
+     *
+     * @param repo The repository.
+     * @return The signature of the working directory.
+     */
+    string walk_workdir_signature(const Repository& repo) {
+        namespace fs = std::filesystem;
+        const string workdir = repo.workdir();
+        size_t signature = 0;
+        auto mix = [&signature](size_t value) {
+            signature ^= value + 0x9e3779b9 + (signature << 6) + (signature >> 2);
+        };
+
+        try {
+            for (auto iter = fs::recursive_directory_iterator(workdir); iter != fs::recursive_directory_iterator(); ++iter) {
+                const fs::path& path = iter->path();
+                const string relative = path.generic_string().substr(workdir.size());
+                if (fs::is_directory(iter->status())) {
+                    if (relative == ".git" || repo.is_path_ignored(relative + "/")) {
+                        iter.disable_recursion_pending();
+                    }
+                } else if (!repo.is_path_ignored(relative)) {
+                    mix(hash<string>()(relative));
+                    mix(fs::file_size(path));
+                    mix(fs::last_write_time(path).time_since_epoch().count());
+                }
+            }
+        } catch (fs::filesystem_error&) {
+            // A file was removed while scanning, so the working directory is still changing.
+            mix(chrono::steady_clock::now().time_since_epoch().count());
+        }
+        return "walk " + to_string(signature);
+    }
+
+    /**
+     * Computes a signature of the working directory that changes whenever a file is added, removed or modified,
+     * so comparing signatures is much cheaper than comparing contents.
+     * The filesystem monitor's token or the stat data found with the untracked cache are used where possible,
+     * as by status_signature(); the whole working directory is only walked if the repository can't be scanned
+     * that way or a file was modified too recently for its stat data to be trusted.
+     *
+     * @param repo The repository.
+     * @return The signature of the working directory.
+     */
+    string workdir_signature(const Repository& repo) {
+        string signature;
+        if (status_signature(repo, repo.index(), query_fsmonitor(repo), signature)) {
+            return signature;
+        }
+        return walk_workdir_signature(repo);
+    }
+
+    /**
+     * Checks whether an error came from reaching the remote rather than from the repository itself,
+     * so that trying again later might succeed.
+     *
+     * @param e The error.
+     * @return True if the error was a network error.
+     */
+    bool is_network_error(const GitException& e) {
+        switch (e.klass()) {
+            case GIT_ERROR_NET:
+            case GIT_ERROR_SSH:
+            case GIT_ERROR_HTTP:
+            case GIT_ERROR_SSL:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    void watch_sync(const Repository& repo, SyncDirection direction, unsigned int debounce, unsigned int interval) {
+        typedef chrono::steady_clock Clock;
+        // Credentials are kept for the whole watch, so the user is only asked once.
+        CredentialStore credentials;
+
+        string signature;
+        Clock::time_point lastChange;
+        bool changed = false;
+        // Sync every branch straight away.
+        Clock::time_point lastFullSync = Clock::now() - chrono::seconds(interval);
+        // After a network error, syncing waits until retryAt, waiting twice as long after each failure in a row.
+        Clock::time_point retryAt = Clock::now();
+        unsigned int backoff = 0;
+        while (true) {
+            const string newSignature = workdir_signature(repo);
+            const Clock::time_point now = Clock::now();
+            if (newSignature != signature) {
+                signature = newSignature;
+                lastChange = now;
+                changed = true;
+            }
+
+            const bool fullSyncDue = now - lastFullSync >= chrono::seconds(interval);
+            const bool changesDue = changed && now - lastChange >= chrono::seconds(debounce);
+            if ((fullSyncDue || changesDue) && now >= retryAt) {
+                try {
+                    // Local changes only affect the current branch, so the other branches can wait for a full sync.
+                    const Head head = get_head(repo);
+                    const bool currentOnly = !(fullSyncDue || head.detached)
+                                             && matches_branch_pattern(get_sync_only(repo), head.name);
+                    sync(repo, &credentials, direction, false, currentOnly ? head.name : "", false, nullptr);
+                    backoff = 0;
+                } catch (GitException& e) {
+                    // Any other error would happen again on every sync, so stop watching.
+                    if (!is_network_error(e)) {
+                        throw;
+                    }
+                    backoff = max(1u, min(backoff * 2, interval));
+                    retryAt = Clock::now() + chrono::seconds(backoff);
+                    cout << "Sync failed: " << e.what() << " Retrying in " << backoff << " seconds." << endl;
+                }
+
+                if (backoff == 0) {
+                    // Pulling the current branch may have changed the working directory.
+                    signature = workdir_signature(repo);
+                    changed = false;
+                    if (fullSyncDue) {
+                        lastFullSync = Clock::now();
+                    }
+                }
+            }
+            this_thread::sleep_for(chrono::milliseconds(WATCH_POLL_MILLISECONDS));
+        }
+    }
+
+    void prefetch(const Repository& repo) {
+        CredentialStore credentials;
+        git_fetch_options fetchOpts = GIT_FETCH_OPTIONS_INIT;
+        fetchOpts.callbacks.credentials = acquire_credentials;
+        CredentialPayload payload{&credentials, &repo, false};
+        fetchOpts.callbacks.payload = &payload;
+        fetchOpts.callbacks.transfer_progress = transfer_progress;
+        fetchOpts.prune = GIT_FETCH_PRUNE;
+
+        // Fetching only writes remote-tracking refs, so the sync cache still records what was last synced.
+        Remote origin = repo.lookup_remote("origin");
+        origin.fetch(StrArray(make_fetch_refspecs(get_sync_only(repo), get_wip_namespace(repo))), fetchOpts);
+        clear_progress_bar();
+    }
+
+    void prefetch_repeatedly(const Repository& repo, unsigned int interval, unsigned int backoff) {
+        unsigned int wait = interval;
+        while (true) {
+            const time_t now = time(nullptr);
+            try {
+                prefetch(repo);
+                cout << put_time(localtime(&now), "%F %T") << " Prefetched from origin." << endl;
+                wait = interval;
+            } catch (exception& e) {
+                // Back off in case the remote is unreachable or overloaded.
+                wait = max(min(wait * 2, backoff), interval);
+                cout << put_time(localtime(&now), "%F %T") << " Prefetch failed: " << e.what()
+                     << " Retrying in " << wait << " seconds." << endl;
+            }
+            this_thread::sleep_for(chrono::seconds(wait));
+        }
     }
 
     void force_pull(const Repository& repo) {
-        map<string, RefTargets> branchTargets;
-        get_branch_targets(repo, &branchTargets);
+        BranchTargets branchTargets;
+        get_branch_targets(repo, &branchTargets, get_wip_namespace(repo));
+        filter_branch_targets(branchTargets, get_sync_only(repo), "");
+        Head head = get_head(repo);
+        remove_implicit_branches(branchTargets, head);
+        WipHashMemo wipHashes(repo);
 
-        map<OID, OID> wipCommits;
-        hash_wip_commits(repo, branchTargets, wipCommits);
+        unordered_map<OID, OID> wipCommits;
+        hash_wip_commits(repo, branchTargets, wipCommits, wipHashes);
 
+        RefBatch batch(repo);
         vector<string> syncedBranches;
-        for(const auto& entry : branchTargets) {
-            const string branchName = entry.first;
-            const RefTargets targets = entry.second;
-            pull(repo, branchName, targets, wipCommits);
+        for(const auto *entry : sorted_branch_targets(branchTargets)) {
+            const string& branchName = entry->first;
+            const RefTargets& targets = entry->second;
+            pull(repo, branchName, targets, wipCommits, head, batch);
 
             syncedBranches.push_back(branchName);
             syncedBranches.push_back(to_wip(branchName));
         }
+        batch.commit();
 
-        update_sync_cache(repo, syncedBranches);
+        update_sync_cache(repo, syncedBranches, wipHashes);
+        wipHashes.save();
     }
 }
\ No newline at end of file
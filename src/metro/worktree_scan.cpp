@@ -0,0 +1,986 @@
+namespace metro {
+#ifdef _WIN32
+    bool scan_worktree(const Repository& repo, Index& index) {
+        // The scanner relies on POSIX stat data, so leave Windows to libgit2.
+        return false;
+    }
+
+    bool scan_paths(const Repository& repo, Index& index, const unordered_set<string>& paths) {
+        return false;
+    }
+
+    bool paths_changed(const Repository& repo, const Index& index, const unordered_set<string>& paths, bool& changed) {
+        return false;
+    }
+
+    bool probe_worktree(const Repository& repo, const Index& index, bool& changed) {
+        return false;
+    }
+
+    bool status_signature(const Repository& repo, const Index& index, const FsmonitorQuery& query, string& out) {
+        return false;
+    }
+#else
+
+#ifdef __APPLE__
+#define ST_CTIME_NSEC(st) ((st).st_ctimespec.tv_nsec)
+#define ST_MTIME_NSEC(st) ((st).st_mtimespec.tv_nsec)
+#else
+#define ST_CTIME_NSEC(st) ((st).st_ctim.tv_nsec)
+#define ST_MTIME_NSEC(st) ((st).st_mtim.tv_nsec)
+#endif
+
+    /**
+     * Thrown while scanning on finding something that libgit2 handles in a way the scanner doesn't replicate.
+     */
+    struct UnsupportedWorktree {};
+
+    // Index entries of the tracked files, by path.
+    typedef unordered_map<string, const git_index_entry *> TrackedFiles;
+
+    // A file in the working directory that may need adding to the index.
+    struct ScannedFile {
+        string path;                    // Path relative to the working directory.
+        struct stat st{};               // Result of lstat() on the file.
+        uint32_t mode = 0;              // Mode the file would have in the index.
+    };
+
+    /**
+     * Call a function for every index from 0 to count - 1, spread across several threads.
+     * Each thread is given its own handle to the repository, as libgit2 repository handles
+     * must not be shared between threads.
+     *
+     * @param repo The repository.
+     * @param count The number of indices to call the function for.
+     * @param perThread The minimum number of indices worth starting a thread for.
+     * @param func Function taking the repository handle and index.
+     */
+    void parallel_for(const Repository& repo, size_t count, size_t perThread,
+                      const function<void(const Repository&, size_t)>& func) {
+        size_t threadCount = min((size_t) thread::hardware_concurrency(), count / perThread);
+        if (threadCount <= 1) {
+            for (size_t i = 0; i < count; i++) {
+                func(repo, i);
+            }
+            return;
+        }
+
+        // Each thread takes the next index until none are left.
+        atomic<size_t> next(0);
+        vector<exception_ptr> errors(threadCount);
+        vector<thread> threads;
+        for (size_t t = 0; t < threadCount; t++) {
+            threads.emplace_back([&, t]() {
+                try {
+                    Repository threadRepo = Repository::open(repo.path());
+                    for (size_t i = next++; i < count; i = next++) {
+                        func(threadRepo, i);
+                    }
+                } catch (...) {
+                    errors[t] = current_exception();
+                    // Stop the other threads early.
+                    next = count;
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+
+        for (const auto& error : errors) {
+            if (error) {
+                rethrow_exception(error);
+            }
+        }
+    }
+
+    /**
+     * Call a function for indices from 0 to count - 1 on several threads, as parallel_for() does,
+     * but skip the remaining indices once the function has returned true for any of them.
+     *
+     * @param repo The repository.
+     * @param count The number of indices to call the function for.
+     * @param perThread The minimum number of indices worth starting a thread for.
+     * @param func Function taking the repository handle and index, returning true to stop.
+     * @return True if the function returned true for any index.
+     */
+    bool parallel_any(const Repository& repo, size_t count, size_t perThread,
+                      const function<bool(const Repository&, size_t)>& func) {
+        atomic<bool> found(false);
+        parallel_for(repo, count, perThread, [&](const Repository& threadRepo, size_t i) {
+            if (!found && func(threadRepo, i)) {
+                found = true;
+            }
+        });
+        return found;
+    }
+
+    /**
+     * Get a boolean config variable, or a default if it isn't set.
+     */
+    bool get_config_bool(const Repository& repo, const string& name, bool defaultValue) {
+        try {
+            return repo.config().get_bool(name);
+        } catch (GitException&) {
+            return defaultValue;
+        }
+    }
+
+    /**
+     * Whether the scanner can handle a repository, rather than leaving it to libgit2.
+     */
+    bool can_scan(const Repository& repo, const Index& index) {
+        return !repo.workdir().empty() && !index.has_conflicts()
+               && !get_config_bool(repo, "core.ignorecase", false) && get_config_bool(repo, "core.symlinks", true);
+    }
+
+    /**
+     * Work out the mode a file would be given in the index, in the same way as libgit2.
+     *
+     * @param st The result of lstat() on the file.
+     * @param existing The file's existing index entry, or nullptr if it is untracked.
+     * @param trustFilemode The value of core.filemode.
+     * @return The index mode.
+     */
+    uint32_t index_mode(const struct stat& st, const git_index_entry *existing, bool trustFilemode) {
+        if (S_ISLNK(st.st_mode)) {
+            return GIT_FILEMODE_LINK;
+        }
+        if (!trustFilemode) {
+            // The executable bit can't be trusted, so keep whatever mode the file already had.
+            return existing != nullptr && existing->mode != GIT_FILEMODE_LINK ? existing->mode : GIT_FILEMODE_BLOB;
+        }
+        return (st.st_mode & S_IXUSR) ? GIT_FILEMODE_BLOB_EXECUTABLE : GIT_FILEMODE_BLOB;
+    }
+
+    /**
+     * Checks whether a file's stat data matches its index entry closely enough to assume it is unchanged.
+     * Files modified in the same instant as the index was written are never assumed to be unchanged,
+     * as they may have changed again since their entry was recorded.
+     *
+     * @param entry The file's index entry.
+     * @param file The scanned file.
+     * @param indexStat The result of stat() on the index file.
+     * @return True if the file does not need hashing.
+     */
+    bool stat_matches(const git_index_entry& entry, const ScannedFile& file, const struct stat& indexStat) {
+        const struct stat& st = file.st;
+        bool racy = entry.mtime.seconds > (int32_t) indexStat.st_mtime
+                    || (entry.mtime.seconds == (int32_t) indexStat.st_mtime
+                        && entry.mtime.nanoseconds >= (uint32_t) ST_MTIME_NSEC(indexStat));
+        return !racy && entry.mode == file.mode && entry.file_size == (uint32_t) st.st_size
+               && entry.mtime.seconds == (int32_t) st.st_mtime && entry.mtime.nanoseconds == (uint32_t) ST_MTIME_NSEC(st)
+               && entry.ctime.seconds == (int32_t) st.st_ctime && entry.ctime.nanoseconds == (uint32_t) ST_CTIME_NSEC(st)
+               && entry.ino == (uint32_t) st.st_ino && entry.uid == st.st_uid && entry.gid == st.st_gid;
+    }
+
+    /**
+     * Create an index entry for a scanned file, with its stat data.
+     *
+     * @param file The scanned file.
+     * @param id The OID of the file's blob.
+     * @return The entry, which refers to the path in file.
+     */
+    git_index_entry make_index_entry(const ScannedFile& file, const OID& id) {
+        git_index_entry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.ctime.seconds = (int32_t) file.st.st_ctime;
+        entry.ctime.nanoseconds = (uint32_t) ST_CTIME_NSEC(file.st);
+        entry.mtime.seconds = (int32_t) file.st.st_mtime;
+        entry.mtime.nanoseconds = (uint32_t) ST_MTIME_NSEC(file.st);
+        entry.dev = (uint32_t) file.st.st_dev;
+        entry.ino = (uint32_t) file.st.st_ino;
+        entry.mode = file.mode;
+        entry.uid = file.st.st_uid;
+        entry.gid = file.st.st_gid;
+        entry.file_size = (uint32_t) file.st.st_size;
+        entry.id = id.oid;
+        entry.path = file.path.c_str();
+        return entry;
+    }
+
+    /**
+     * Calculate the OID a scanned file's blob would have, without writing it.
+     * Symlinks are hashed by their target, as git stores them, rather than followed.
+     *
+     * @param repo The repository.
+     * @param workdir The repository's working directory, ending with a '/'.
+     * @param file The scanned file.
+     * @return The OID of the file's blob.
+     */
+    OID hash_scanned_file(const Repository& repo, const string& workdir, const ScannedFile& file) {
+        if (!S_ISLNK(file.st.st_mode)) {
+            return repo.hashfile(file.path);
+        }
+
+        string target(file.st.st_size + 1, '\0');
+        ssize_t length = readlink((workdir + file.path).c_str(), &target[0], target.size());
+        if (length < 0 || (size_t) length >= target.size()) {
+            // The link was changed while scanning.
+            throw UnsupportedWorktree();
+        }
+        git_oid hash;
+        int err = git_odb_hash(&hash, target.data(), length, GIT_OBJECT_BLOB);
+        check_error(err);
+        return OID(hash);
+    }
+
+    // The cached listing of a directory in the working directory.
+    struct CachedDirectory {
+        int64_t mtimeSeconds = -1;      // Modification time of the directory, or -1 if the listing mustn't be reused.
+        long mtimeNanoseconds = 0;
+        string ignoreHash;              // Hash of the directory's .gitignore, from hash_file().
+        // The directory's files and subdirectories, each with a flag:
+        // 'u' for an untracked file that isn't ignored, 'i' for an ignored untracked file,
+        // 't' for a file that was tracked, whose ignore status hasn't been checked,
+        // or 'd' for a subdirectory that isn't ignored. Ignored subdirectories are left out.
+        vector<pair<char, string>> entries;
+    };
+
+    // A directory to list while finding untracked files.
+    struct DirectoryScan {
+        string path;                    // Path relative to the working directory, ending with a '/', or empty for the working directory itself.
+        bool ignoresChanged = false;    // Whether the ignore rules for this directory may have changed since it was cached.
+        CachedDirectory listing;        // The contents of the directory.
+        bool reread = false;            // Whether the directory was read, rather than its listing taken from the cache.
+        bool cacheable = false;         // Whether the listing can be written to the cache.
+    };
+
+    /**
+     * Hash the contents of a file, to detect changes to ignore files.
+     *
+     * @param path The path to the file.
+     * @return The hash of the file, or "-" if the file doesn't exist.
+     */
+    string hash_file(const string& path) {
+        ifstream file(path, ios::binary);
+        if (!file.is_open()) {
+            return "-";
+        }
+        string contents((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+        git_oid hash;
+        int err = git_odb_hash(&hash, contents.data(), contents.size(), GIT_OBJECT_BLOB);
+        check_error(err);
+        return OID(hash).str();
+    }
+
+    string ignore_stamp(const Repository& repo) {
+        const char *home = getenv("HOME");
+        string excludesFile;
+        try {
+            excludesFile = repo.config().get_string_buf("core.excludesfile");
+        } catch (GitException&) {
+            // libgit2 falls back to the XDG ignore file if core.excludesfile isn't set.
+            const char *xdgConfig = getenv("XDG_CONFIG_HOME");
+            if (xdgConfig != nullptr && *xdgConfig != '\0') {
+                excludesFile = string(xdgConfig) + "/git/ignore";
+            } else if (home != nullptr) {
+                excludesFile = string(home) + "/.config/git/ignore";
+            }
+        }
+        if (excludesFile.rfind("~/", 0) == 0 && home != nullptr) {
+            excludesFile = home + excludesFile.substr(1);
+        }
+        return hash_file(repo.path() + "info/exclude") + " " + hash_file(excludesFile);
+    }
+
+    /**
+     * Read the untracked cache from .git/metro-untracked.
+     * After a header line and a line holding the ignore stamp, each directory has a line starting with 'D'
+     * followed by its mtime in seconds and nanoseconds, the hash of its .gitignore and its path,
+     * all separated by spaces. Each of the directory's entries follows on its own line, as its flag,
+     * a space and its name.
+     * The cache is only an optimisation, so a missing, corrupt or outdated cache is treated as empty.
+     *
+     * @param repo The repository.
+     * @param stamp The current ignore stamp, from ignore_stamp().
+     * @param out The map to write the cached directories to, keyed by path.
+     */
+    void read_untracked_cache(const Repository& repo, const string& stamp, unordered_map<string, CachedDirectory>& out) {
+        string path = repo.path() + UNTRACKED_CACHE_FILE;
+        error_code ec;
+        if (!std::filesystem::exists(path, ec)) {
+            return;
+        }
+
+        try {
+            string contents = read_all(path);
+            size_t start = strlen(UNTRACKED_CACHE_HEADER);
+            size_t end = contents.find('\n', start);
+            if (contents.compare(0, start, UNTRACKED_CACHE_HEADER) != 0 || end == string::npos
+                    || contents.compare(start, end - start, stamp) != 0) {
+                return;
+            }
+
+            CachedDirectory *current = nullptr;
+            for (start = end + 1; start < contents.size(); start = end + 1) {
+                end = contents.find('\n', start);
+                if (end == string::npos) {
+                    end = contents.size();
+                }
+                if (end - start < 2 || contents[start + 1] != ' ') {
+                    throw MetroException("Corrupt untracked cache: " + path);
+                }
+                const char flag = contents[start];
+                const string rest = contents.substr(start + 2, end - start - 2);
+
+                if (flag == 'D') {
+                    size_t nanoStart = rest.find(' ') + 1;
+                    size_t hashStart = rest.find(' ', nanoStart) + 1;
+                    size_t pathStart = rest.find(' ', hashStart) + 1;
+                    if (nanoStart == 0 || hashStart == 0 || pathStart == 0) {
+                        throw MetroException("Corrupt untracked cache: " + path);
+                    }
+                    current = &out[rest.substr(pathStart)];
+                    current->mtimeSeconds = stoll(rest.substr(0, nanoStart - 1));
+                    current->mtimeNanoseconds = stol(rest.substr(nanoStart, hashStart - nanoStart - 1));
+                    current->ignoreHash = rest.substr(hashStart, pathStart - hashStart - 1);
+                } else if (current != nullptr) {
+                    current->entries.emplace_back(flag, rest);
+                } else {
+                    throw MetroException("Corrupt untracked cache: " + path);
+                }
+            }
+        } catch (exception& e) {
+            out.clear();
+        }
+    }
+
+    /**
+     * Replace the contents of the untracked cache with the given directories, in the format
+     * described in read_untracked_cache(). The file is written under a temporary name and then renamed
+     * over the old one, so other processes never see a partially written cache.
+     *
+     * @param repo The repository.
+     * @param stamp The current ignore stamp, from ignore_stamp().
+     * @param dirs The cached directories, keyed by path.
+     */
+    void write_untracked_cache(const Repository& repo, const string& stamp,
+                               const unordered_map<string, CachedDirectory>& dirs) {
+        string contents = UNTRACKED_CACHE_HEADER + stamp + "\n";
+        for (const auto& dir : dirs) {
+            contents += "D " + to_string(dir.second.mtimeSeconds) + " " + to_string(dir.second.mtimeNanoseconds)
+                        + " " + dir.second.ignoreHash + " " + dir.first + "\n";
+            for (const auto& entry : dir.second.entries) {
+                contents += entry.first;
+                contents += " " + entry.second + "\n";
+            }
+        }
+
+        string path = repo.path() + UNTRACKED_CACHE_FILE;
+        string lockPath = path + ".lock";
+        write_all(contents, lockPath);
+
+        error_code ec;
+        std::filesystem::rename(lockPath, path, ec);
+        if (ec) {
+            std::filesystem::remove(lockPath, ec);
+            throw MetroException("Failed to write untracked cache: " + path);
+        }
+    }
+
+    /**
+     * Read the contents of a directory in the working directory into its listing.
+     *
+     * @param repo The repository.
+     * @param workdir The repository's working directory, ending with a '/'.
+     * @param tracked The index entries of all the tracked files.
+     * @param scan The directory to read.
+     * @throws UnsupportedWorktree If the directory is a nested repository.
+     */
+    void read_directory(const Repository& repo, const string& workdir,
+                        const TrackedFiles& tracked, DirectoryScan& scan) {
+        DIR *handle = opendir((workdir + scan.path).c_str());
+        if (handle == nullptr) {
+            // Leave libgit2 to report the error.
+            throw UnsupportedWorktree();
+        }
+        unique_ptr<DIR, int (*)(DIR *)> closer(handle, closedir);
+
+        for (dirent *ent = readdir(handle); ent != nullptr; ent = readdir(handle)) {
+            const string name = ent->d_name;
+            if (name == "." || name == "..") {
+                continue;
+            }
+            if (name == ".git") {
+                // libgit2 adds nested repositories as gitlinks, which the scanner doesn't do.
+                if (!scan.path.empty()) {
+                    throw UnsupportedWorktree();
+                }
+                continue;
+            }
+            if (name.find('\n') != string::npos) {
+                // The cache is line-based, so can't hold this name.
+                scan.cacheable = false;
+            }
+            const string path = scan.path + name;
+            // Tracked files are checked against their index entries, so don't stat them twice.
+            if ((ent->d_type == DT_REG || ent->d_type == DT_LNK) && tracked.find(path) != tracked.end()) {
+                scan.listing.entries.emplace_back('t', name);
+                continue;
+            }
+
+            struct stat st{};
+            if (lstat((workdir + path).c_str(), &st) != 0) {
+                // The file was deleted while scanning.
+                continue;
+            }
+            if (S_ISDIR(st.st_mode)) {
+                if (!repo.is_path_ignored(path)) {
+                    scan.listing.entries.emplace_back('d', name);
+                }
+            } else if (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode)) {
+                if (tracked.find(path) != tracked.end()) {
+                    scan.listing.entries.emplace_back('t', name);
+                } else {
+                    scan.listing.entries.emplace_back(repo.is_path_ignored(path) ? 'i' : 'u', name);
+                }
+            }
+        }
+    }
+
+    /**
+     * List a directory in the working directory, finding its subdirectories to scan next
+     * and the untracked files in it that aren't ignored. The directory is only read if its
+     * cached listing is out of date.
+     *
+     * @param repo The repository.
+     * @param workdir The repository's working directory, ending with a '/'.
+     * @param tracked The index entries of all the tracked files.
+     * @param cache The untracked cache.
+     * @param scanStart The time at which the scan started.
+     * @param scan The directory to list.
+     * @param untracked Output for the paths of the untracked files.
+     * @throws UnsupportedWorktree If the directory is a nested repository.
+     */
+    void list_directory(const Repository& repo, const string& workdir, const TrackedFiles& tracked,
+                        const unordered_map<string, CachedDirectory>& cache, time_t scanStart,
+                        DirectoryScan& scan, vector<string>& untracked) {
+        const string fullPath = workdir + scan.path;
+        struct stat dirStat{};
+        if (lstat(fullPath.c_str(), &dirStat) != 0 || !S_ISDIR(dirStat.st_mode)) {
+            // The directory was deleted while scanning.
+            return;
+        }
+        const string ignoreHash = hash_file(fullPath + ".gitignore");
+
+        auto cached = cache.find(scan.path);
+        if (cached != cache.end() && !scan.ignoresChanged && cached->second.ignoreHash == ignoreHash
+                && cached->second.mtimeSeconds == (int64_t) dirStat.st_mtime
+                && cached->second.mtimeNanoseconds == (long) ST_MTIME_NSEC(dirStat)) {
+            scan.listing = cached->second;
+            scan.cacheable = true;
+        } else {
+            // New ignore rules in this directory affect all of its subdirectories too.
+            scan.ignoresChanged = scan.ignoresChanged || cached == cache.end() || cached->second.ignoreHash != ignoreHash;
+            scan.reread = true;
+            scan.cacheable = true;
+            // A directory modified in the same second as the scan could be modified again without its mtime changing,
+            // so its listing is cached with an mtime that never matches. Its ignore hash is still needed.
+            scan.listing.mtimeSeconds = dirStat.st_mtime < scanStart ? (int64_t) dirStat.st_mtime : -1;
+            scan.listing.mtimeNanoseconds = (long) ST_MTIME_NSEC(dirStat);
+            scan.listing.ignoreHash = ignoreHash;
+            read_directory(repo, workdir, tracked, scan);
+        }
+
+        for (const auto& entry : scan.listing.entries) {
+            const string path = scan.path + entry.second;
+            // Files may have been added to or removed from the index since the directory was cached.
+            if (tracked.find(path) != tracked.end()) {
+                continue;
+            }
+            if (entry.first == 'u' || (entry.first == 't' && !repo.is_path_ignored(path))) {
+                untracked.push_back(path);
+            }
+        }
+    }
+
+    /**
+     * Find the untracked files in the working directory that aren't ignored, one level of directories
+     * at a time, using and then updating the untracked cache.
+     *
+     * @param repo The repository.
+     * @param workdir The repository's working directory, ending with a '/'.
+     * @param tracked The index entries of all the tracked files.
+     * @param out Output for the paths of the untracked files.
+     * @param firstOnly Whether to stop after the first level of directories containing an untracked file,
+     *        in which case the cache isn't updated.
+     * @throws UnsupportedWorktree If the working directory contains a nested repository.
+     */
+    void walk_untracked(const Repository& repo, const string& workdir,
+                        const TrackedFiles& tracked, vector<string>& out, bool firstOnly) {
+        const string stamp = ignore_stamp(repo);
+        unordered_map<string, CachedDirectory> cache;
+        read_untracked_cache(repo, stamp, cache);
+        const time_t scanStart = time(nullptr);
+
+        unordered_map<string, CachedDirectory> updated;
+        bool changed = false;
+        vector<DirectoryScan> level(1);
+        while (!level.empty()) {
+            if (firstOnly && !out.empty()) {
+                return;
+            }
+            vector<vector<string>> untracked(level.size());
+            parallel_for(repo, level.size(), WORKTREE_SCAN_DIRECTORIES_PER_THREAD,
+                         [&](const Repository& threadRepo, size_t i) {
+                list_directory(threadRepo, workdir, tracked, cache, scanStart, level[i], untracked[i]);
+            });
+
+            vector<DirectoryScan> next;
+            for (size_t i = 0; i < level.size(); i++) {
+                DirectoryScan& scan = level[i];
+                out.insert(out.end(), untracked[i].begin(), untracked[i].end());
+                for (const auto& entry : scan.listing.entries) {
+                    if (entry.first == 'd') {
+                        DirectoryScan subdir;
+                        subdir.path = scan.path + entry.second + "/";
+                        subdir.ignoresChanged = scan.ignoresChanged;
+                        next.push_back(move(subdir));
+                    }
+                }
+                changed = changed || scan.reread;
+                if (scan.cacheable) {
+                    updated.emplace(scan.path, move(scan.listing));
+                }
+            }
+            level = move(next);
+        }
+
+        // Directories that no longer exist are dropped from the cache too.
+        if (changed || updated.size() != cache.size()) {
+            try {
+                write_untracked_cache(repo, stamp, updated);
+            } catch (MetroException&) {
+                // The cache is only an optimisation, so the scan can still succeed without it.
+            }
+        }
+    }
+
+    bool scan_worktree(const Repository& repo, Index& index) {
+        if (!can_scan(repo, index)) {
+            return false;
+        }
+        const string workdir = repo.workdir();
+        const bool trustFilemode = get_config_bool(repo, "core.filemode", true);
+        struct stat indexStat{};
+        stat((repo.path() + "index").c_str(), &indexStat);
+
+        try {
+            // Check every tracked file against its index entry.
+            const size_t entryCount = index.entrycount();
+            vector<const git_index_entry *> entries(entryCount);
+            TrackedFiles tracked;
+            for (size_t i = 0; i < entryCount; i++) {
+                entries[i] = index.get_byindex(i);
+                if (entries[i]->mode == GIT_FILEMODE_COMMIT) {
+                    throw UnsupportedWorktree();
+                }
+                tracked.emplace(entries[i]->path, entries[i]);
+            }
+
+            vector<ScannedFile> trackedFiles(entryCount);
+            // Whether each tracked file is unchanged, or has been deleted.
+            vector<char> unchanged(entryCount), deleted(entryCount);
+            parallel_for(repo, entryCount, WORKTREE_SCAN_FILES_PER_THREAD, [&](const Repository&, size_t i) {
+                ScannedFile& file = trackedFiles[i];
+                file.path = entries[i]->path;
+                if (lstat((workdir + file.path).c_str(), &file.st) != 0 || S_ISDIR(file.st.st_mode)) {
+                    deleted[i] = true;
+                } else if (S_ISREG(file.st.st_mode) || S_ISLNK(file.st.st_mode)) {
+                    file.mode = index_mode(file.st, entries[i], trustFilemode);
+                    unchanged[i] = stat_matches(*entries[i], file, indexStat);
+                } else {
+                    throw UnsupportedWorktree();
+                }
+            });
+
+            // Find the untracked files, and stat them to create their index entries.
+            vector<string> untrackedPaths;
+            walk_untracked(repo, workdir, tracked, untrackedPaths, false);
+            vector<ScannedFile> untrackedFiles(untrackedPaths.size());
+            vector<char> found(untrackedPaths.size());
+            parallel_for(repo, untrackedPaths.size(), WORKTREE_SCAN_FILES_PER_THREAD, [&](const Repository&, size_t i) {
+                ScannedFile& file = untrackedFiles[i];
+                file.path = untrackedPaths[i];
+                // The file may have been deleted or replaced since it was listed.
+                found[i] = lstat((workdir + file.path).c_str(), &file.st) == 0
+                           && (S_ISREG(file.st.st_mode) || S_ISLNK(file.st.st_mode));
+                file.mode = index_mode(file.st, nullptr, trustFilemode);
+            });
+
+            // Hash the changed and untracked files, writing their blobs.
+            vector<const ScannedFile *> toHash;
+            for (size_t i = 0; i < entryCount; i++) {
+                if (!unchanged[i] && !deleted[i]) {
+                    toHash.push_back(&trackedFiles[i]);
+                }
+            }
+            for (size_t i = 0; i < untrackedFiles.size(); i++) {
+                if (found[i]) {
+                    toHash.push_back(&untrackedFiles[i]);
+                }
+            }
+            vector<OID> ids(toHash.size());
+            parallel_for(repo, toHash.size(), WORKTREE_SCAN_FILES_PER_THREAD,
+                         [&](const Repository& threadRepo, size_t i) {
+                ids[i] = threadRepo.create_blob_from_workdir(toHash[i]->path);
+            });
+
+            // Nothing has been changed yet, so the index is only modified if the whole scan succeeds.
+            for (size_t i = 0; i < entryCount; i++) {
+                if (deleted[i]) {
+                    index.remove(trackedFiles[i].path, 0);
+                }
+            }
+            for (size_t i = 0; i < toHash.size(); i++) {
+                index.add(make_index_entry(*toHash[i], ids[i]));
+            }
+        } catch (UnsupportedWorktree&) {
+            return false;
+        }
+        return true;
+    }
+
+    // A file reported by the filesystem monitor that differs from the index.
+    struct ChangedPath {
+        ScannedFile file;
+        const git_index_entry *entry = nullptr;     // The file's index entry, or nullptr if it is untracked.
+    };
+
+    /**
+     * Compare the given paths in the working directory against the index, without reading anything else.
+     * A directory path, ending with a '/', covers all the files in and below it.
+     *
+     * @param repo The repository.
+     * @param workdir The repository's working directory, ending with a '/'.
+     * @param index The repository's index.
+     * @param paths The paths to compare, relative to the working directory.
+     * @param removed Output for the tracked files that no longer exist.
+     * @param changed Output for the tracked files whose stat data doesn't match their index entries,
+     *        and the untracked files that aren't ignored.
+     * @throws UnsupportedWorktree If the paths can't be compared exactly as libgit2 would,
+     *         a .gitignore file has changed, or a path is inside a nested repository.
+     */
+    void compare_paths(const Repository& repo, const string& workdir, const Index& index,
+                       const unordered_set<string>& paths, vector<string>& removed, vector<ChangedPath>& changed) {
+        const bool trustFilemode = get_config_bool(repo, "core.filemode", true);
+        struct stat indexStat{};
+        stat((repo.path() + "index").c_str(), &indexStat);
+
+        const size_t entryCount = index.entrycount();
+        TrackedFiles tracked;
+        for (size_t i = 0; i < entryCount; i++) {
+            const git_index_entry *entry = index.get_byindex(i);
+            if (entry->mode == GIT_FILEMODE_COMMIT) {
+                throw UnsupportedWorktree();
+            }
+            tracked.emplace(entry->path, entry);
+        }
+
+        vector<string> files;
+        for (const string& path : paths) {
+            const size_t slash = path.find_last_of('/', path.size() - 2);
+            if (path.compare(slash == string::npos ? 0 : slash + 1, string::npos, ".gitignore") == 0) {
+                // The ignore rules have changed, which could affect any file.
+                throw UnsupportedWorktree();
+            }
+            if (path.back() != '/') {
+                files.push_back(path);
+                continue;
+            }
+
+            // The index is sorted by path, so the tracked files below the directory are found by binary search.
+            size_t first = 0, last = entryCount;
+            while (first < last) {
+                const size_t middle = first + (last - first) / 2;
+                if (strcmp(index.get_byindex(middle)->path, path.c_str()) < 0) {
+                    first = middle + 1;
+                } else {
+                    last = middle;
+                }
+            }
+            for (size_t i = first; i < entryCount && strncmp(index.get_byindex(i)->path, path.c_str(), path.size()) == 0; i++) {
+                files.emplace_back(index.get_byindex(i)->path);
+            }
+
+            // Find the untracked files below the directory.
+            struct stat dirStat{};
+            if (lstat((workdir + path).c_str(), &dirStat) != 0 || !S_ISDIR(dirStat.st_mode) || repo.is_path_ignored(path)) {
+                continue;
+            }
+            vector<string> dirs{path};
+            while (!dirs.empty()) {
+                DirectoryScan scan;
+                scan.path = dirs.back();
+                dirs.pop_back();
+                read_directory(repo, workdir, tracked, scan);
+                for (const auto& entry : scan.listing.entries) {
+                    if (entry.first == 'u') {
+                        files.push_back(scan.path + entry.second);
+                    } else if (entry.first == 'd') {
+                        dirs.push_back(scan.path + entry.second + "/");
+                    }
+                }
+            }
+        }
+        // A file may be covered by more than one path, but only needs checking once.
+        sort(files.begin(), files.end());
+        files.erase(unique(files.begin(), files.end()), files.end());
+
+        // The monitor reports paths inside nested repositories too, which libgit2 would add as gitlinks,
+        // so check that no directory above each file contains a .git.
+        unordered_set<string> checkedDirs;
+        for (const string& file : files) {
+            for (size_t slash = file.find('/'); slash != string::npos; slash = file.find('/', slash + 1)) {
+                const string dir = file.substr(0, slash + 1);
+                if (!checkedDirs.insert(dir).second) {
+                    continue;
+                }
+                struct stat gitStat{};
+                if (has_suffix(dir, "/.git/") || dir == ".git/" || lstat((workdir + dir + ".git").c_str(), &gitStat) == 0) {
+                    throw UnsupportedWorktree();
+                }
+            }
+        }
+
+        vector<ChangedPath> candidates(files.size());
+        vector<char> missing(files.size()), differs(files.size());
+        parallel_for(repo, files.size(), WORKTREE_SCAN_FILES_PER_THREAD, [&](const Repository& threadRepo, size_t i) {
+            ChangedPath& candidate = candidates[i];
+            ScannedFile& file = candidate.file;
+            file.path = files[i];
+            auto entry = tracked.find(file.path);
+            candidate.entry = entry == tracked.end() ? nullptr : entry->second;
+
+            if (lstat((workdir + file.path).c_str(), &file.st) != 0 || S_ISDIR(file.st.st_mode)) {
+                missing[i] = candidate.entry != nullptr;
+            } else if (!S_ISREG(file.st.st_mode) && !S_ISLNK(file.st.st_mode)) {
+                if (candidate.entry != nullptr) {
+                    throw UnsupportedWorktree();
+                }
+            } else if (candidate.entry != nullptr) {
+                file.mode = index_mode(file.st, candidate.entry, trustFilemode);
+                differs[i] = !stat_matches(*candidate.entry, file, indexStat);
+            } else {
+                file.mode = index_mode(file.st, nullptr, trustFilemode);
+                differs[i] = !threadRepo.is_path_ignored(file.path);
+            }
+        });
+
+        for (size_t i = 0; i < files.size(); i++) {
+            if (missing[i]) {
+                removed.push_back(files[i]);
+            } else if (differs[i]) {
+                changed.push_back(candidates[i]);
+            }
+        }
+    }
+
+    bool scan_paths(const Repository& repo, Index& index, const unordered_set<string>& paths) {
+        if (!can_scan(repo, index)) {
+            return false;
+        }
+
+        try {
+            vector<string> removed;
+            vector<ChangedPath> changed;
+            compare_paths(repo, repo.workdir(), index, paths, removed, changed);
+
+            vector<OID> ids(changed.size());
+            parallel_for(repo, changed.size(), WORKTREE_SCAN_FILES_PER_THREAD,
+                         [&](const Repository& threadRepo, size_t i) {
+                ids[i] = threadRepo.create_blob_from_workdir(changed[i].file.path);
+            });
+
+            for (const string& path : removed) {
+                index.remove(path, 0);
+            }
+            for (size_t i = 0; i < changed.size(); i++) {
+                index.add(make_index_entry(changed[i].file, ids[i]));
+            }
+        } catch (UnsupportedWorktree&) {
+            return false;
+        }
+        return true;
+    }
+
+    bool paths_changed(const Repository& repo, const Index& index, const unordered_set<string>& paths, bool& changed) {
+        if (!can_scan(repo, index)) {
+            return false;
+        }
+
+        try {
+            vector<string> removed;
+            vector<ChangedPath> candidates;
+            compare_paths(repo, repo.workdir(), index, paths, removed, candidates);
+            if (!removed.empty()) {
+                changed = true;
+                return true;
+            }
+
+            // Files whose stat data has changed may still have the same content, so hash them to check.
+            vector<char> differs(candidates.size());
+            parallel_for(repo, candidates.size(), WORKTREE_SCAN_FILES_PER_THREAD,
+                         [&](const Repository& threadRepo, size_t i) {
+                const ChangedPath& candidate = candidates[i];
+                differs[i] = candidate.entry == nullptr || candidate.entry->mode != candidate.file.mode
+                             || hash_scanned_file(threadRepo, repo.workdir(), candidate.file) != OID(candidate.entry->id);
+            });
+            changed = find(differs.begin(), differs.end(), true) != differs.end();
+        } catch (UnsupportedWorktree&) {
+            return false;
+        }
+        return true;
+    }
+
+    bool probe_worktree(const Repository& repo, const Index& index, bool& changed) {
+        if (!can_scan(repo, index)) {
+            return false;
+        }
+        const string workdir = repo.workdir();
+        const bool trustFilemode = get_config_bool(repo, "core.filemode", true);
+        struct stat indexStat{};
+        stat((repo.path() + "index").c_str(), &indexStat);
+
+        try {
+            const size_t entryCount = index.entrycount();
+            vector<const git_index_entry *> entries(entryCount);
+            TrackedFiles tracked;
+            for (size_t i = 0; i < entryCount; i++) {
+                entries[i] = index.get_byindex(i);
+                if (entries[i]->mode == GIT_FILEMODE_COMMIT) {
+                    throw UnsupportedWorktree();
+                }
+                tracked.emplace(entries[i]->path, entries[i]);
+            }
+
+            // First compare the tracked files' stat data with their index entries, which only takes an lstat() each.
+            vector<ScannedFile> trackedFiles(entryCount);
+            vector<char> needsHash(entryCount);
+            changed = parallel_any(repo, entryCount, WORKTREE_SCAN_FILES_PER_THREAD, [&](const Repository&, size_t i) {
+                ScannedFile& file = trackedFiles[i];
+                file.path = entries[i]->path;
+                if (lstat((workdir + file.path).c_str(), &file.st) != 0 || S_ISDIR(file.st.st_mode)) {
+                    return true;
+                }
+                if (!S_ISREG(file.st.st_mode) && !S_ISLNK(file.st.st_mode)) {
+                    throw UnsupportedWorktree();
+                }
+                file.mode = index_mode(file.st, entries[i], trustFilemode);
+                if (stat_matches(*entries[i], file, indexStat)) {
+                    return false;
+                }
+                // A different mode or size means the file has changed without needing to hash it,
+                // though git zeroes the size of racily clean entries, so those must be hashed.
+                if (file.mode != entries[i]->mode
+                        || (entries[i]->file_size != 0 && entries[i]->file_size != (uint32_t) file.st.st_size)) {
+                    return true;
+                }
+                needsHash[i] = true;
+                return false;
+            });
+            if (changed) {
+                return true;
+            }
+
+            // Then look for untracked files, which only reads directories that have changed since they were cached.
+            vector<string> untracked;
+            walk_untracked(repo, workdir, tracked, untracked, true);
+            if (!untracked.empty()) {
+                changed = true;
+                return true;
+            }
+
+            // Finally hash the files whose stat data changed, in case only their timestamps did.
+            vector<size_t> toHash;
+            for (size_t i = 0; i < entryCount; i++) {
+                if (needsHash[i]) {
+                    toHash.push_back(i);
+                }
+            }
+            changed = parallel_any(repo, toHash.size(), WORKTREE_SCAN_FILES_PER_THREAD,
+                                   [&](const Repository& threadRepo, size_t j) {
+                const size_t i = toHash[j];
+                return hash_scanned_file(threadRepo, workdir, trackedFiles[i]) != OID(entries[i]->id);
+            });
+        } catch (UnsupportedWorktree&) {
+            return false;
+        }
+        return true;
+    }
+
+    string index_signature(const Repository& repo) {
+        struct stat st{};
+        if (stat((repo.path() + "index").c_str(), &st) != 0) {
+            return "-";
+        }
+        return to_string(st.st_mtime) + "." + to_string(ST_MTIME_NSEC(st)) + " "
+               + to_string(st.st_size) + " " + to_string(st.st_ino);
+    }
+
+    bool status_signature(const Repository& repo, const Index& index, const FsmonitorQuery& query, string& out) {
+        if (!can_scan(repo, index)) {
+            return false;
+        }
+        const string prefix = index_signature(repo) + "\n" + ignore_stamp(repo) + "\n";
+        if (!query.token.empty()) {
+            // The monitor's token only changes when something in the working directory does.
+            out = prefix + "fsmonitor " + query.token;
+            return true;
+        }
+
+        const string workdir = repo.workdir();
+        const time_t scanStart = time(nullptr);
+        try {
+            vector<string> paths;
+            TrackedFiles tracked;
+            for (size_t i = 0; i < index.entrycount(); i++) {
+                const git_index_entry *entry = index.get_byindex(i);
+                if (entry->mode == GIT_FILEMODE_COMMIT) {
+                    throw UnsupportedWorktree();
+                }
+                tracked.emplace(entry->path, entry);
+                paths.emplace_back(entry->path);
+            }
+            walk_untracked(repo, workdir, tracked, paths, false);
+
+            // Hash the stat data of every file, tracked or untracked.
+            vector<size_t> hashes(paths.size());
+            vector<char> racy(paths.size());
+            parallel_for(repo, paths.size(), WORKTREE_SCAN_FILES_PER_THREAD, [&](const Repository&, size_t i) {
+                size_t& signature = hashes[i];
+                auto mix = [&signature](size_t value) {
+                    signature ^= value + 0x9e3779b9 + (signature << 6) + (signature >> 2);
+                };
+                mix(hash<string>()(paths[i]));
+                struct stat st{};
+                if (lstat((workdir + paths[i]).c_str(), &st) == 0) {
+                    mix(st.st_mode);
+                    mix(st.st_size);
+                    mix(st.st_mtime);
+                    mix(ST_MTIME_NSEC(st));
+                    mix(st.st_ctime);
+                    mix(ST_CTIME_NSEC(st));
+                    mix(st.st_ino);
+                    // A file modified in the same second as the scan could change again without its stat data changing.
+                    racy[i] = st.st_mtime >= scanStart;
+                }
+            });
+            if (find(racy.begin(), racy.end(), true) != racy.end()) {
+                return false;
+            }
+
+            size_t signature = 0;
+            for (size_t value : hashes) {
+                signature ^= value + 0x9e3779b9 + (signature << 6) + (signature >> 2);
+            }
+            out = prefix + "stat " + to_string(paths.size()) + " " + to_string(signature);
+        } catch (UnsupportedWorktree&) {
+            return false;
+        }
+        return true;
+    }
+#endif //_WIN32
+}
@@ -18,6 +18,7 @@
 #include "gitwrapper/diff.cpp"
 #include "gitwrapper/config.cpp"
 #include "gitwrapper/treebuilder.cpp"
+#include "gitwrapper/transaction.cpp"
 
 #include "metro/metro.cpp"
 #include "metro/merging.cpp"
@@ -25,6 +26,8 @@
 #include "metro/syncing.cpp"
 #include "metro/branch_descriptor.cpp"
 #include "metro/url_descriptor.cpp"
+#include "metro/worktree_scan.cpp"
+#include "metro/fsmonitor.cpp"
 
 #include "commands/create.cpp"
 #include "commands/clone.cpp"
@@ -37,6 +40,8 @@
 #include "commands/absorb.cpp"
 #include "commands/resolve.cpp"
 #include "commands/sync.cpp"
+#include "commands/prefetch.cpp"
+#include "commands/fsmonitor.cpp"
 #include "commands/list.cpp"
 #include "commands/sink.cpp"
 #include "commands/rename.cpp"
@@ -0,0 +1,132 @@
+#!/usr/bin/env bash
+# Times Metro operations on large generated repositories.
+# Not part of the test suite; run it by hand against a metro binary on the PATH.
+#
+# Usage: ./benchmark.sh sync [branch counts...]
+#        ./benchmark.sh untracked [file counts...]
+
+set -e
+
+BENCH_DIR=$(mktemp -d "${TMPDIR:-/tmp}/metro_bench.XXXXXX")
+trap 'rm -rf "$BENCH_DIR"' EXIT
+TIMEFORMAT="%R"
+
+# Time a command in seconds, discarding its output.
+time_cmd() {
+  { time "$@" > /dev/null 2>&1 ; } 2>&1
+}
+
+# Sync a clone of a remote with the given number of branches, after one of them has changed remotely.
+# Every branch exists locally as well as on the remote, so none of them are implicit.
+# This exercises fetching and planning across every branch, while only pulling one.
+bench_sync() {
+  local count=$1
+  local dir="$BENCH_DIR/sync_$count"
+  mkdir -p "$dir"
+  cd "$dir"
+
+  git init -q --bare remote/repo
+  git init -q seed
+  cd seed
+  git commit -q --allow-empty -m "Initial commit"
+  local base
+  base=$(git rev-parse HEAD)
+  git push -q ../remote/repo master
+  cd ..
+
+  # Create the branches directly in the remote, as pushing them one by one would take far longer.
+  for ((i = 0; i < count; i++)); do
+    echo "create refs/heads/branch$i $base"
+  done | git --git-dir=remote/repo update-ref --stdin
+
+  # Clones leave the other branches implicit, where they are skipped before planning,
+  # so create them locally too and sync once to record them in the sync cache.
+  metro clone remote/repo > /dev/null
+  for ((i = 0; i < count; i++)); do
+    echo "create refs/heads/branch$i $base"
+  done | git --git-dir=repo/.git update-ref --stdin
+  (cd repo && metro sync > /dev/null)
+
+  # Move one branch on the remote so that the sync can't take the no-op path.
+  local moved
+  moved=$(git --git-dir=remote/repo commit-tree -p "$base" -m "Remote commit" "$(git --git-dir=remote/repo rev-parse "$base^{tree}")")
+  git --git-dir=remote/repo update-ref refs/heads/branch0 "$moved"
+
+  cd repo
+  local changed unchanged
+  changed=$(time_cmd metro sync)
+  unchanged=$(time_cmd metro sync)
+  cd ../..
+
+  printf "%10d %14s %14s\n" "$count" "$changed" "$unchanged"
+}
+
+# Check a working directory with the given number of tracked files for changes, with and without the untracked cache.
+# The files are spread across directories of 100, alongside an ignored build directory and a few untracked files.
+bench_untracked() {
+  local count=$1
+  local dir="$BENCH_DIR/untracked_$count"
+  mkdir -p "$dir"
+  cd "$dir"
+
+  git init -q repo
+  cd repo
+  for ((i = 0; i < count; i++)); do
+    if ((i % 100 == 0)); then
+      mkdir -p "src/dir$((i / 1000))/sub$((i / 100))" "build/dir$((i / 100))"
+    fi
+    echo "$i" > "src/dir$((i / 1000))/sub$((i / 100))/file$i.txt"
+    echo "$i" > "build/dir$((i / 100))/file$i.o"
+  done
+  echo "build/" > .gitignore
+  git add .
+  git commit -q -m "Initial commit"
+  for ((i = 0; i < count; i += 1000)); do
+    echo "untracked" > "src/dir$((i / 1000))/untracked.txt"
+  done
+  # Directories modified in the same second as a scan aren't cached.
+  sleep 1
+
+  local infoCold infoWarm wipCold wipWarm
+  rm -f .git/metro-untracked
+  infoCold=$(time_cmd metro info)
+  infoWarm=$(time_cmd metro info)
+  # Commit the untracked files, so that 'metro wip save' finds nothing to save after checking the whole tree.
+  metro commit "Add untracked files" > /dev/null
+  rm -f .git/metro-untracked
+  wipCold=$(time_cmd metro wip save)
+  wipWarm=$(time_cmd metro wip save)
+  cd ../..
+
+  printf "%10d %14s %14s %14s %14s\n" "$count" "$infoCold" "$infoWarm" "$wipCold" "$wipWarm"
+}
+
+case "$1" in
+  sync)
+    shift
+    counts=("$@")
+    if [[ ${#counts[@]} -eq 0 ]]; then
+      counts=(1000 10000 100000)
+    fi
+    printf "%10s %14s %14s\n" "branches" "changed (s)" "no-op (s)"
+    for count in "${counts[@]}"; do
+      (bench_sync "$count")
+    done
+    ;;
+  untracked)
+    shift
+    counts=("$@")
+    if [[ ${#counts[@]} -eq 0 ]]; then
+      counts=(10000 100000)
+    fi
+    printf "%10s %14s %14s %14s %14s\n" "files" "info cold (s)" "info warm (s)" "clean cold (s)" "clean warm (s)"
+    for count in "${counts[@]}"; do
+      (bench_untracked "$count")
+    done
+    ;;
+  *)
+    echo "Usage: $0 sync [branch counts...]"
+    echo "       $0 untracked [file counts...]"
+    exit 1
+    ;;
+esac
@@ -89,6 +89,141 @@ setup() {
   [[ "${lines[3]}" == *"Test commit message 1"* ]]
 }
 
+@test "Commit respects ignore rules" {
+  echo "Mark 1"
+  git init
+  mkdir -p dir/sub build
+  printf '*.log\nbuild/\n' > .gitignore
+  echo "tracked content" > build/keep.txt
+  git add -f build/keep.txt
+  git commit -m "Track ignored file"
+
+  echo "Mark 2"
+  echo "sub content" > dir/sub/file.txt
+  echo "log content" > dir/debug.log
+  echo "changed content" > build/keep.txt
+  echo "build output" > build/out.txt
+  ln -s dir/sub/file.txt link
+  printf '#!/bin/sh\n' > script.sh
+  chmod +x script.sh
+  metro commit "Scan commit"
+  run git ls-tree -r --name-only HEAD
+  [[ "$output" == $'.gitignore\nbuild/keep.txt\ndir/sub/file.txt\nlink\nscript.sh' ]]
+  [[ "$(git show HEAD:build/keep.txt)" == "changed content" ]]
+  [[ "$(git ls-tree HEAD script.sh | cut -c1-6)" == "100755" ]]
+  [[ "$(git ls-tree HEAD link | cut -c1-6)" == "120000" ]]
+
+  echo "Mark 3"
+  rm dir/sub/file.txt
+  metro commit "Delete file"
+  run git ls-tree -r --name-only HEAD
+  [[ "$output" != *"dir/sub/file.txt"* ]]
+  run git status --porcelain
+  [[ "$output" == "" ]]
+}
+
+@test "Commit ignores executable bit without core.filemode" {
+  git init
+  git config core.filemode false
+  git commit --allow-empty -m "Initial commit"
+  printf '#!/bin/sh\n' > script.sh
+  chmod +x script.sh
+  metro commit "Add script"
+  [[ "$(git ls-tree HEAD script.sh | cut -c1-6)" == "100644" ]]
+  [[ "$(git ls-files -s script.sh | cut -c1-6)" == "100644" ]]
+}
+
+@test "Untracked cache follows ignore rule changes" {
+  echo "Mark 1"
+  git init
+  mkdir dir
+  echo "log content" > dir/debug.log
+  echo "text content" > dir/notes.txt
+  printf '*.log\n' > .gitignore
+  # Backdate the directories so that their listings are cached.
+  touch -d "2020-01-01" . dir
+  metro commit "First commit"
+  [ -f .git/metro-untracked ]
+  run git ls-tree -r --name-only HEAD
+  [[ "$output" == $'.gitignore\ndir/notes.txt' ]]
+
+  echo "Mark 2"
+  # Rewriting the ignore file doesn't change any directory mtimes.
+  printf '*.tmp\n' > .gitignore
+  touch -d "2020-01-01" . dir
+  metro commit "Unignore logs"
+  run git ls-tree -r --name-only HEAD
+  [[ "$output" == $'.gitignore\ndir/debug.log\ndir/notes.txt' ]]
+
+  echo "Mark 3"
+  echo "backup content" > dir/notes.bak
+  printf '*.bak\n' > .git/info/exclude
+  touch -d "2020-01-01" . dir
+  run metro wip save
+  [[ "$output" == "No uncommitted changes to save." ]]
+
+  echo "Mark 4"
+  printf '' > .git/info/exclude
+  touch -d "2020-01-01" . dir
+  run metro wip save
+  [[ "$output" != "No uncommitted changes to save." ]]
+}
+
+@test "Commit with filesystem monitor" {
+  echo "Mark 1"
+  git init
+  mkdir dir
+  echo "content 1" > dir/file1.txt
+  echo "content 2" > file2.txt
+  metro fsmonitor > ../fsmonitor.log 2>&1 3>&- &
+  monitor_pid=$!
+  for i in {1..50}; do
+    grep -q "Monitoring" ../fsmonitor.log && break
+    sleep 0.1
+  done
+  metro commit "First commit"
+  [ -f .git/metro-fsmonitor-token ]
+
+  echo "Mark 2"
+  echo "changed content" > dir/file1.txt
+  rm file2.txt
+  mkdir -p new/sub
+  echo "new content" > new/sub/file3.txt
+  metro commit "Second commit"
+  run git ls-tree -r --name-only HEAD
+  [[ "$output" == $'dir/file1.txt\nnew/sub/file3.txt' ]]
+  [[ "$(git show HEAD:dir/file1.txt)" == "changed content" ]]
+
+  echo "Mark 3"
+  run metro info
+  [[ "$output" == *"Nothing to commit"* ]]
+  echo "more content" >> new/sub/file3.txt
+  run metro info
+  [[ "$output" == *"1 file to modify"* ]]
+
+  echo "Mark 4"
+  git init nested
+  echo "nested content" > nested/file.txt
+  git -C nested add file.txt
+  git -C nested commit -m "Nested commit"
+  metro commit "Nested commit"
+  echo "changed nested content" > nested/file.txt
+  echo "more content" >> dir/file1.txt
+  metro commit "Change nested file"
+  run git ls-tree -r --name-only HEAD
+  [[ "$output" != *"nested/file.txt"* ]]
+  git rm -r -q --cached --ignore-unmatch nested
+  rm -rf nested
+
+  echo "Mark 5"
+  kill $monitor_pid
+  echo "content 4" > file4.txt
+  metro commit "Third commit"
+  run git ls-tree -r --name-only HEAD
+  [[ "$output" == $'dir/file1.txt\nfile4.txt\nnew/sub/file3.txt' ]]
+  [[ "$(git show HEAD:new/sub/file3.txt)" == $'new content\nmore content' ]]
+}
+
 # ~~~ Test Clone ~~~
 
 @test "Clone empty repo" {
@@ -447,195 +582,944 @@ setup() {
   echo "$ git branch --list"
   git branch --list
   run git branch --list
-  [[ "${lines[0]}" == "  master" ]]
-  [[ "${lines[1]}" == "* master#1" ]]
+  [[ "${lines[0]}" == "  master" ]]
+  [[ "${lines[1]}" == "* master#1" ]]
+
+  echo "$ git log"
+  git log
+  run git log
+  [[ "${lines[3]}" == *"Local2 commit message"* ]]
+  echo "$ git log master"
+  git log master
+  run git log master
+  [[ "${lines[3]}" == *"Local1 commit message 2"* ]]
+}
+
+@test "Sync updated WIP" {
+  echo "$ git init remote"
+  git init remote/repo --bare
+
+  mkdir local1
+  cd local1
+  echo "$ cd ~/local1"
+  echo "$ git clone git@remote & echo \"local1 file content 1\" > local1-1.txt & git commit -am \"Local1 commit message\""
+  git clone ../remote/repo
+  cd repo
+  echo "local1 file content 1" > local1-1.txt
+  git add -A
+  git commit -m "Local1 commit message 1"
+
+  cd ../..
+  mkdir local2
+  cd local2
+  echo "$ cd ~/local2"
+  echo "$ git clone git@remote"
+  git clone ../remote/repo
+
+  echo "$ cd ~/local1"
+  cd ../local1/repo
+  echo "$ metro sync"
+  metro sync
+  echo "$ cd ~/local2"
+  cd ../../local2/repo
+  echo "$ metro sync"
+  metro sync
+
+  cd ../../local1/repo
+  echo "$ cd ~/local1"
+  echo "$ echo \"local1 file content 2\" > local1-2.txt"
+  echo "local1 file content 2" > local1-2.txt
+  git add -A
+  echo "$ metro sync"
+  metro sync
+  cd ../../local2/repo
+  echo "$ cd ~/local2"
+  echo "$ echo \"local2 file content\" > local2.txt"
+  echo "local2 file content" > local2.txt
+  git add -A
+  echo "$ metro sync"
+  metro sync
+
+  echo "$ git branch --list"
+  git branch --list
+  run git branch --list
+  [[ "${lines[0]}" == "  master" ]]
+  [[ "${lines[1]}" == "* master#1" ]]
+  [[ "${lines[2]}" == "  master#wip" ]]
+
+  [[ -f "local2.txt" ]]
+
+  metro switch master
+
+  [[ -f "local1-2.txt" ]]
+}
+
+@test "Sync WIP with no branches" {
+  git init remote/repo --bare
+
+  echo "Mark 1"
+  mkdir local1
+  cd local1
+  echo "Mark 2"
+  git clone ../remote/repo
+  cd repo
+  echo "Mark 3"
+  echo "local1 file content" > local1.txt
+  metro sync
+
+  echo "Mark 4"
+  cd ../..
+  mkdir local2
+  cd local2
+  echo "Mark 5"
+  metro clone ../remote/repo
+  cd repo
+
+  echo "Mark 6"
+  run git branch --list
+  [[ "${#lines[@]}" == 0 ]]
+
+  echo "Mark 7"
+  run git status
+  [[ "${lines[2]}" == "Changes to be committed:" ]]
+  [[ "${lines[4]}" == *"new file:   local1.txt" ]]
+}
+
+@test "Sync down changes with unchanged local WIP" {
+  git init remote/repo --bare
+
+  echo "Mark 1"
+  mkdir local1
+  cd local1
+  echo "Mark 2"
+  git clone ../remote/repo
+  cd repo
+  echo "Mark 3"
+  echo "local1 file content" > local1.txt
+  metro commit "local1 commit"
+  echo "local1 file content 2" > local1-2.txt
+  metro sync
+
+  echo "Mark 4"
+  cd ../..
+  mkdir local2
+  cd local2
+  echo "Mark 5"
+  metro clone ../remote/repo
+  cd repo
+  echo "Mark 6"
+  metro commit "local2 commit"
+  echo "Mark 7"
+  metro sync
+
+  echo "Mark 8"
+  cd ../../local1/repo
+  metro sync
+  echo "Mark 9"
+
+  run git branch --list
+  [[ "$output" == "* master" ]]
+
+  run git log master
+  [[ "${lines[3]}" == *"local2 commit"* ]]
+}
+
+@test "Sync down changes with unchanged local WIP but changed base" {
+  git init remote/repo --bare
+
+  echo "Mark 1"
+  mkdir local1
+  cd local1
+  echo "Mark 2"
+  git clone ../remote/repo
+  cd repo
+  echo "Mark 3"
+  echo "local1 file content" > local1.txt
+  metro commit "local1 commit"
+  echo "local1 file content 2" > local1-2.txt
+  echo "local1 file content 3" > local1-3.txt
+  metro sync
+
+  echo "Mark 4"
+  cd ../..
+  mkdir local2
+  cd local2
+  echo "Mark 5"
+  metro clone ../remote/repo
+  cd repo
+  echo "Mark 6"
+  metro commit "local2 commit"
+  echo "Mark 7"
+  metro sync
+
+  echo "Mark 8"
+  cd ../../local1/repo
+  rm local1-3.txt
+  metro commit "local1 commit 2"
+  echo "Mark 9"
+  echo "local1 file content 3" > local1-3.txt
+  metro sync
+  echo "Mark 10"
+
+  run git branch --list
+  [[ "${lines[0]}" == "  master" ]]
+  [[ "${lines[1]}" == "* master#1" ]]
+  [[ "${#lines[@]}" == 2 ]]
+
+  run git log master
+  [[ "${lines[3]}" == *"local2 commit"* ]]
+
+  run git log master#1
+  [[ "${lines[3]}" == *"local1 commit 2"* ]]
+}
+
+@test "Sync WIP without touching the working directory" {
+  git init remote/repo --bare
+
+  echo "Mark 1"
+  mkdir local1
+  cd local1
+  git clone ../remote/repo
+  cd repo
+  echo "local1 file content" > local1.txt
+  metro commit "local1 commit"
+  metro sync
+
+  echo "Mark 2"
+  echo "local1 file content 2" > local1.txt
+  echo "local1 file content 3" > local1-3.txt
+  before=$(stat -c %Y local1.txt)
+  sleep 1
+  metro sync
+
+  echo "Mark 3"
+  [[ "$(stat -c %Y local1.txt)" == "$before" ]]
+  [[ "$(cat local1.txt)" == "local1 file content 2" ]]
+  [[ "$(cat local1-3.txt)" == "local1 file content 3" ]]
+
+  run git branch --list
+  [[ "$output" == "* master" ]]
+
+  run git ls-remote ../../remote/repo
+  [[ "$output" == *"refs/heads/master#wip"* ]]
+}
+
+@test "Sync recovers from an unreachable remote" {
+  git init remote/repo --bare
+
+  echo "Mark 1"
+  mkdir local1
+  cd local1
+  git clone ../remote/repo
+  cd repo
+  echo "local1 file content" > local1.txt
+  metro commit "local1 commit"
+  metro sync
+
+  echo "Mark 2"
+  echo "local1 wip content" > wip.txt
+  git remote set-url origin ../../remote/missing
+  run metro sync
+  [ "$status" -ne 0 ]
+  run git branch --list
+  [[ "$output" == "* master" ]]
+  [[ "$(cat wip.txt)" == "local1 wip content" ]]
+
+  echo "Mark 3"
+  run metro sync
+  [ "$status" -ne 0 ]
+  [[ "$output" != *"already exists"* ]]
+
+  echo "Mark 4"
+  git remote set-url origin ../../remote/repo
+  metro sync
+  [[ "$(cat wip.txt)" == "local1 wip content" ]]
+  [[ "$(git --git-dir=../../remote/repo show "master#wip:wip.txt")" == "local1 wip content" ]]
+}
+
+@test "Sync skips fetch when nothing has changed" {
+  git init remote/repo --bare
+
+  echo "Mark 1"
+  mkdir local1
+  cd local1
+  git clone ../remote/repo
+  cd repo
+  echo "local1 file content" > local1.txt
+  metro commit "local1 commit"
+  metro sync
+
+  echo "Mark 2"
+  run metro sync
+  [[ "$output" == *"Branch master is already synced."* ]]
+  [[ "$output" != *"Fetching"* ]]
+  [[ "$output" != *"Branch master is ready."* ]]
+  [[ "$(grep -c "Syncing with" <<< "$output")" == 1 ]]
+
+  echo "Mark 3"
+  cd ../..
+  mkdir local2
+  cd local2
+  metro clone ../remote/repo
+  cd repo
+  echo "local2 file content" > local2.txt
+  metro commit "local2 commit"
+  metro sync
+
+  echo "Mark 4"
+  cd ../../local1/repo
+  run metro sync
+  [[ "$output" == *"Fetching"* ]]
+  [[ "$(cat local2.txt)" == "local2 file content" ]]
+}
+
+@test "Sync migrates legacy sync cache" {
+  git init remote/repo --bare
+
+  echo "Mark 1"
+  mkdir local1
+  cd local1
+  git clone ../remote/repo
+  cd repo
+  echo "local1 file content" > local1.txt
+  metro commit "local1 commit"
+  metro sync
+  [[ "$(cat .git/packed-synced)" == *"$(git rev-parse master) master"* ]]
+
+  echo "Mark 2"
+  # Rewrite the cache in the old one-file-per-branch layout.
+  rm .git/packed-synced
+  mkdir .git/synced
+  git rev-parse master | tr -d '\n' > .git/synced/master
+  echo "local1 file content 2" > local1.txt
+  metro commit "local1 commit 2"
+  run metro sync
+  [[ "$output" == *"Pushing master..."* ]]
+
+  echo "Mark 3"
+  [[ ! -e .git/synced ]]
+  [[ "$(cat .git/packed-synced)" == *"$(git rev-parse master) master"* ]]
+}
+
+@test "Sync waits for the sync cache lock" {
+  git init remote/repo --bare
+
+  echo "Mark 1"
+  mkdir local1
+  cd local1
+  git clone ../remote/repo
+  cd repo
+  echo "local1 file content" > local1.txt
+  metro commit "local1 commit"
+  metro sync
+
+  echo "Mark 2"
+  echo "local1 file content 2" > local1.txt
+  metro commit "local1 commit 2"
+  touch .git/packed-synced.lock
+  (sleep 1; rm .git/packed-synced.lock) &
+  metro sync
+  [[ "$(cat .git/packed-synced)" == *"$(git rev-parse master) master"* ]]
+
+  echo "Mark 3"
+  echo "local1 file content 3" > local1.txt
+  metro commit "local1 commit 3"
+  touch .git/packed-synced.lock
+  run metro sync
+  [ "$status" -ne 0 ]
+  [[ "$output" == *"packed-synced.lock: File exists"* ]]
+  rm .git/packed-synced.lock
+}
+
+@test "Sync memoizes WIP hashes" {
+  git init remote/repo --bare
+
+  echo "Mark 1"
+  mkdir local1
+  cd local1
+  git clone ../remote/repo
+  cd repo
+  echo "local1 file content" > local1.txt
+  metro commit "local1 commit"
+  echo "local1 file content 2" > local1.txt
+  metro sync
+
+  echo "Mark 2"
+  wip=$(git rev-parse "master#wip" 2>/dev/null || git ls-remote ../../remote/repo "refs/heads/master#wip" | cut -f1)
+  [[ "$(cat .git/wip-hashes)" == *"$wip "* ]]
+
+  echo "Mark 3"
+  # A corrupt memo is ignored and rewritten.
+  echo "garbage" > .git/wip-hashes
+  echo "local1 file content 3" > local1.txt
+  metro sync
+  [[ "$(cat .git/wip-hashes)" != *"garbage"* ]]
+}
+
+@test "Sync WIP branch whose base was deleted remotely" {
+  git init remote/repo --bare
+
+  echo "Mark 1"
+  mkdir local1
+  cd local1
+  git clone ../remote/repo
+  cd repo
+  echo "local1 file content" > local1.txt
+  metro commit "local1 commit"
+  git branch other
+  git branch "other#wip" "$(git commit-tree -p other -m WIP "other^{tree}")"
+  metro sync
+
+  echo "Mark 2"
+  echo "wip content" > wip.txt
+  git add wip.txt
+  wip=$(git commit-tree -p master -m WIP "$(git write-tree)")
+  git reset -q
+  rm wip.txt
+  git push -q ../../remote/repo "+$wip:refs/heads/other#wip" :refs/heads/other
+
+  echo "Mark 3"
+  metro sync
+  run git branch --list other
+  [[ "$output" == "" ]]
+  [[ "$(git rev-parse "other#wip")" == "$wip" ]]
+}
+
+@test "Sync many differing branches" {
+  git init remote/repo --bare
+  remote=$(cd remote/repo && pwd)
+
+  echo "Mark 1"
+  mkdir local1
+  cd local1
+  git clone ../remote/repo
+  cd repo
+  echo "local1 file content" > local1.txt
+  metro commit "local1 commit"
+  base=$(git rev-parse master)
+  tree=$(git rev-parse "master^{tree}")
+  # Enough branches differ for them to be planned on several threads.
+  for i in {0..199}; do
+    echo "create refs/heads/branch$(printf %03d $i) $base"
+  done | git update-ref --stdin
+  metro sync
+
+  echo "Mark 2"
+  # Every third branch is pushed, pulled or in conflict, in turn.
+  expected=""
+  for i in {0..199}; do
+    name="branch$(printf %03d $i)"
+    if ((i % 3 != 1)); then
+      git update-ref "refs/heads/$name" "$(git commit-tree -p "$base" -m "Local $i" "$tree")"
+    fi
+    if ((i % 3 != 0)); then
+      git --git-dir="$remote" update-ref "refs/heads/$name" \
+          "$(git --git-dir="$remote" commit-tree -p "$base" -m "Remote $i" "$tree")"
+    fi
+    case $((i % 3)) in
+      0) expected+="Pushing $name..."$'\n' ;;
+      1) expected+="Pulling $name..."$'\n' ;;
+      2) expected+="Branch $name had remote changes that conflicted with yours; your commits have been moved to $name#1."$'\n' ;;
+    esac
+  done
+  declare -A localHeads remoteHeads
+  for i in {0..199}; do
+    name="branch$(printf %03d $i)"
+    localHeads[$name]=$(git rev-parse "$name")
+    remoteHeads[$name]=$(git --git-dir="$remote" rev-parse "$name")
+  done
+
+  echo "Mark 3"
+  run metro sync
+  [ "$status" -eq 0 ]
+  [[ "$(echo "$output" | grep -E "^(Pushing|Pulling) branch|^Branch branch")"$'\n' == "$expected" ]]
+  for i in {0..199}; do
+    name="branch$(printf %03d $i)"
+    case $((i % 3)) in
+      0)
+        [[ "$(git --git-dir="$remote" rev-parse "$name")" == "${localHeads[$name]}" ]]
+        [[ "$(git rev-parse "$name")" == "${localHeads[$name]}" ]]
+        ;;
+      1)
+        [[ "$(git rev-parse "$name")" == "${remoteHeads[$name]}" ]]
+        ;;
+      2)
+        [[ "$(git rev-parse "$name")" == "${remoteHeads[$name]}" ]]
+        [[ "$(git rev-parse "$name#1")" == "${localHeads[$name]}" ]]
+        [[ "$(git --git-dir="$remote" rev-parse "$name#1")" == "${localHeads[$name]}" ]]
+        ;;
+    esac
+  done
+}
+
+@test "Sync only some branches" {
+  git init remote/repo --bare
+
+  echo "Mark 1"
+  mkdir local1
+  cd local1
+  git clone ../remote/repo
+  cd repo
+  echo "local1 file content" > local1.txt
+  metro commit "local1 commit"
+  metro sync
+
+  echo "Mark 2"
+  cd ../..
+  mkdir local2
+  cd local2
+  metro clone ../remote/repo
+  cd repo
+  echo "local2 file content" > local2.txt
+  metro commit "local2 commit"
+  metro branch other
+  echo "other file content" > other.txt
+  metro commit "other commit"
+  metro sync
+
+  echo "Mark 3"
+  cd ../../local1/repo
+  run metro sync --current
+  [[ "$output" == *"Pulling master..."* ]]
+  [[ "$output" != *"Pulling other"* ]]
+  [[ "$(cat local2.txt)" == "local2 file content" ]]
+  run git branch --list other
+  [[ "$output" == "" ]]
+
+  echo "Mark 4"
+  run metro sync --only "oth*"
+  [[ "$output" == *"Fetching oth* from remote..."* ]]
+  [[ "$(git rev-parse origin/other)" == "$(git --git-dir=../../remote/repo rev-parse other)" ]]
+  metro switch other
+  [[ "$(cat other.txt)" == "other file content" ]]
+
+  echo "Mark 5"
+  cd ../../local2/repo
+  metro switch other
+  echo "other wip content" > wip.txt
+  metro sync --only "*her"
+  git --git-dir=../../remote/repo rev-parse --verify "refs/heads/other#wip"
+
+  echo "Mark 6"
+  cd ../../local1/repo
+  run metro sync --only "*her"
+  [[ "$output" == *"Fetching *her from remote..."* ]]
+  [[ "$(git rev-parse "origin/other#wip")" == "$(git --git-dir=../../remote/repo rev-parse "other#wip")" ]]
+  [[ "$(cat wip.txt)" == "other wip content" ]]
+}
+
+@test "Clone from a file url" {
+  git init remote/repo --bare
+
+  echo "Mark 1"
+  mkdir local1
+  cd local1
+  metro clone ../remote/repo
+  cd repo
+  echo "local1 file content" > local1.txt
+  metro commit "local1 commit"
+  metro sync
+
+  echo "Mark 2"
+  cd ../..
+  mkdir local2
+  cd local2
+  metro clone "file://$(cd ../remote/repo && pwd)"
+  cd repo
+  [[ "$(cat local1.txt)" == "local1 file content" ]]
+  # The object files are hardlinked from the remote rather than transferred.
+  [[ -n "$(find .git/objects -type f -links +1)" ]]
+}
+
+@test "Clone from a cache directory" {
+  git init remote/repo --bare
+
+  echo "Mark 1"
+  mkdir local1
+  cd local1
+  metro clone ../remote/repo
+  cd repo
+  echo "local1 file content" > local1.txt
+  metro commit "local1 commit"
+  metro sync
+
+  echo "Mark 2"
+  cd ../..
+  mkdir local2
+  cd local2
+  metro clone ../remote/repo --cache-dir ../cache
+  cd repo
+  [[ "$(cat local1.txt)" == "local1 file content" ]]
+  [[ "$(cat .git/objects/info/alternates)" == "$(cd ../../cache && pwd)/"*".git/objects" ]]
+  [[ -z "$(ls .git/objects/pack)" ]]
+  echo "local2 file content" > local2.txt
+  metro commit "local2 commit"
+  metro sync
+
+  echo "Mark 3"
+  cd ../..
+  mkdir local3
+  cd local3
+  metro clone ../remote/repo --cache-dir ../cache
+  cd repo
+  [[ "$(cat local2.txt)" == "local2 file content" ]]
+  [[ "$(ls -d ../../cache/*.git | wc -l)" == 1 ]]
+  [[ -f "$(ls -d ../../cache/*.git).lock" ]]
+
+  echo "Mark 4"
+  cd ../../local1/repo
+  metro sync
+  [[ "$(cat local2.txt)" == "local2 file content" ]]
+}
+
+@test "Clone leaves other branches implicit" {
+  git init remote/repo --bare
+
+  echo "Mark 1"
+  mkdir local1
+  cd local1
+  metro clone ../remote/repo
+  cd repo
+  echo "master file content" > master.txt
+  metro commit "master commit"
+  metro branch other
+  echo "other file content" > other.txt
+  metro commit "other commit"
+  metro sync
+
+  echo "Mark 2"
+  cd ../..
+  mkdir local2
+  cd local2
+  metro clone ../remote/repo
+  cd repo
+  run git branch --list
+  [[ "$output" == "* master" ]]
+  [[ "$(cat .git/packed-synced)" != *"other"* ]]
+  run metro list branches
+  [[ "${lines[0]}" == *"master"* ]]
+  [[ "${lines[1]}" == *"other"* ]]
 
-  echo "$ git log"
-  git log
-  run git log
-  [[ "${lines[3]}" == *"Local2 commit message"* ]]
-  echo "$ git log master"
-  git log master
-  run git log master
-  [[ "${lines[3]}" == *"Local1 commit message 2"* ]]
+  echo "Mark 3"
+  run metro sync
+  [[ "$output" != *"other"* ]]
+  run git branch --list other
+  [[ "$output" == "" ]]
+
+  echo "Mark 4"
+  metro switch other
+  [[ "$(cat other.txt)" == "other file content" ]]
+  echo "other file content 2" > other.txt
+  metro commit "other commit 2"
+  run metro sync
+  [[ "$output" == *"Pushing other..."* ]]
+  [[ "$(git --git-dir=../../remote/repo log -1 --format=%s other)" == "other commit 2" ]]
 }
 
-@test "Sync updated WIP" {
-  echo "$ git init remote"
+@test "Clone a single branch" {
   git init remote/repo --bare
 
+  echo "Mark 1"
   mkdir local1
   cd local1
-  echo "$ cd ~/local1"
-  echo "$ git clone git@remote & echo \"local1 file content 1\" > local1-1.txt & git commit -am \"Local1 commit message\""
-  git clone ../remote/repo
+  metro clone ../remote/repo
   cd repo
-  echo "local1 file content 1" > local1-1.txt
-  git add -A
-  git commit -m "Local1 commit message 1"
+  echo "master file content" > master.txt
+  metro commit "master commit"
+  metro branch other
+  echo "other file content" > other.txt
+  metro commit "other commit"
+  metro sync
 
+  echo "Mark 2"
   cd ../..
   mkdir local2
   cd local2
-  echo "$ cd ~/local2"
-  echo "$ git clone git@remote"
-  git clone ../remote/repo
+  metro clone ../remote/repo --branch other
+  cd repo
+  [[ "$(git rev-parse --abbrev-ref HEAD)" == "other" ]]
+  [[ "$(git config metro.syncOnly)" == "other" ]]
+  run git branch --list master
+  [[ "$output" == "" ]]
+  [[ "$(cat other.txt)" == "other file content" ]]
 
-  echo "$ cd ~/local1"
-  cd ../local1/repo
-  echo "$ metro sync"
-  metro sync
-  echo "$ cd ~/local2"
-  cd ../../local2/repo
-  echo "$ metro sync"
+  echo "Mark 3"
+  echo "more content" > more.txt
+  metro commit "more commit"
   metro sync
+  run git branch --list master
+  [[ "$output" == "" ]]
+  [[ "$(git --git-dir=../../remote/repo log -1 --format=%s other)" == "more commit" ]]
+  [[ "$(git --git-dir=../../remote/repo log -1 --format=%s master)" == "master commit" ]]
 
-  cd ../../local1/repo
-  echo "$ cd ~/local1"
-  echo "$ echo \"local1 file content 2\" > local1-2.txt"
-  echo "local1 file content 2" > local1-2.txt
-  git add -A
-  echo "$ metro sync"
-  metro sync
-  cd ../../local2/repo
-  echo "$ cd ~/local2"
-  echo "$ echo \"local2 file content\" > local2.txt"
-  echo "local2 file content" > local2.txt
-  git add -A
-  echo "$ metro sync"
+  echo "Mark 4"
+  metro branch foo
+  metro switch other
+  run metro sync
+  [ "$status" -eq 0 ]
+  [[ "$output" == *"Branch foo is not synced because metro.syncOnly is set to 'other'."* ]]
+  [[ "$output" != *"Branch other is not synced"* ]]
+  run git --git-dir=../../remote/repo branch --list foo
+  [[ "$output" == "" ]]
+}
+
+@test "Sync pushes to mirrors" {
+  git init remote/repo --bare
+
+  echo "Mark 1"
+  mkdir local1
+  cd local1
+  git clone ../remote/repo
+  cd repo
+  echo "local1 file content" > local1.txt
+  metro commit "local1 commit"
   metro sync
+  git clone -q --bare ../../remote/repo ../../remote/mirror
+  git remote add mirror ../../remote/mirror
+  git remote add broken ../../remote/missing
+  git config --add metro.mirror mirror
+  git config --add metro.mirror broken
 
-  echo "$ git branch --list"
-  git branch --list
-  run git branch --list
-  [[ "${lines[0]}" == "  master" ]]
-  [[ "${lines[1]}" == "* master#1" ]]
-  [[ "${lines[2]}" == "  master#wip" ]]
+  echo "Mark 2"
+  echo "local1 file content 2" > local1.txt
+  metro commit "local1 commit 2"
+  run metro sync
+  [[ "$output" == *"Pushed "*" bytes to mirror."* ]]
+  [[ "$output" == *"Couldn't push to broken"* ]]
+  [[ "$(git --git-dir=../../remote/mirror rev-parse master)" == "$(git rev-parse master)" ]]
+  [[ "$(git --git-dir=../../remote/repo rev-parse master)" == "$(git rev-parse master)" ]]
 
-  [[ -f "local2.txt" ]]
+  echo "Mark 3"
+  git init -q --bare ../../remote/missing
+  run metro sync
+  [ "$status" -eq 0 ]
+  [[ "$output" == *"Pushed "*" bytes to broken."* ]]
+  [[ "$output" != *"to mirror."* ]]
+  [[ "$(git --git-dir=../../remote/missing rev-parse master)" == "$(git rev-parse master)" ]]
 
-  metro switch master
+  echo "Mark 4"
+  run metro sync
+  [[ "$output" == *"Branch master is already synced."* ]]
+  [[ "$output" != *"broken"* ]]
+}
 
-  [[ -f "local1-2.txt" ]]
+@test "Sync squashes WIP chains" {
+  git init remote/repo --bare
+
+  echo "Mark 1"
+  mkdir local1
+  cd local1
+  git clone ../remote/repo
+  cd repo
+  echo "local1 file content" > local1.txt
+  metro commit "local1 commit"
+  metro sync
+
+  echo "Mark 2"
+  git checkout -q -b "master#wip"
+  echo "wip content 1" > wip.txt
+  git add wip.txt
+  git commit -q -m "WIP"
+  echo "wip content 2" > wip.txt
+  git commit -q -am "WIP"
+  git checkout -q master
+  run metro sync
+  [[ "$output" == *"not a valid work in progress branch"* ]]
+
+  echo "Mark 3"
+  git config metro.autoSquashWip true
+  run metro sync
+  [[ "$output" == *"Squashed the WIP commits of master."* ]]
+  [[ "$(git --git-dir=../../remote/repo rev-parse "master#wip^")" == "$(git rev-parse master)" ]]
+  [[ "$(git --git-dir=../../remote/repo show "master#wip:wip.txt")" == "wip content 2" ]]
+  [[ "$(cat wip.txt)" == "wip content 2" ]]
 }
 
-@test "Sync WIP with no branches" {
+@test "Sync watch" {
   git init remote/repo --bare
 
   echo "Mark 1"
   mkdir local1
   cd local1
+  git clone ../remote/repo
+  cd repo
+  echo "local1 file content" > local1.txt
+  metro commit "local1 commit"
+  metro sync
+
   echo "Mark 2"
+  metro sync --watch --debounce 1 --interval 60 > ../watch.log 2>&1 3>&- &
+  watch_pid=$!
+  sleep 1
+  echo "wip content 1" > wip.txt
+  echo "wip content 2" > wip.txt
+  for i in {1..50}; do
+    [[ "$(git --git-dir=../../remote/repo show "master#wip:wip.txt" 2> /dev/null)" == "wip content 2" ]] && break
+    sleep 0.1
+  done
+  kill $watch_pid
+  [[ "$(git --git-dir=../../remote/repo show "master#wip:wip.txt")" == "wip content 2" ]]
+  [[ "$(cat wip.txt)" == "wip content 2" ]]
+}
+
+@test "Sync watch stops on errors" {
+  git init
+  echo "file content" > file.txt
+  metro commit "First commit"
+
+  run timeout 10 metro sync --watch --interval 60
+  [ "$status" -ne 0 ]
+  [ "$status" -ne 124 ]
+}
+
+@test "Prefetch" {
+  git init remote/repo --bare
+
+  echo "Mark 1"
+  mkdir local1
+  cd local1
   git clone ../remote/repo
   cd repo
-  echo "Mark 3"
   echo "local1 file content" > local1.txt
+  metro commit "local1 commit"
   metro sync
 
-  echo "Mark 4"
+  echo "Mark 2"
   cd ../..
   mkdir local2
   cd local2
-  echo "Mark 5"
   metro clone ../remote/repo
   cd repo
+  echo "local2 file content" > local2.txt
+  metro commit "local2 commit"
+  metro sync
 
-  echo "Mark 6"
-  run git branch --list
-  [[ "${#lines[@]}" == 0 ]]
+  echo "Mark 3"
+  cd ../../local1/repo
+  echo "local1 wip content" > wip.txt
+  metro prefetch
+  [[ "$(git rev-parse origin/master)" == "$(git --git-dir=../../remote/repo rev-parse master)" ]]
+  [[ "$(git rev-parse master)" != "$(git rev-parse origin/master)" ]]
+  [ ! -e local2.txt ]
+  [[ "$(cat wip.txt)" == "local1 wip content" ]]
 
-  echo "Mark 7"
-  run git status
-  [[ "${lines[2]}" == "Changes to be committed:" ]]
-  [[ "${lines[4]}" == *"new file:   local1.txt" ]]
+  echo "Mark 4"
+  run metro sync
+  [[ "$output" != *"Fetching"* ]]
+  [[ "$output" == *"Pulling master..."* ]]
+  [[ "$(cat local2.txt)" == "local2 file content" ]]
 }
 
-@test "Sync down changes with unchanged local WIP" {
+@test "Sync current branch first" {
   git init remote/repo --bare
 
   echo "Mark 1"
   mkdir local1
   cd local1
-  echo "Mark 2"
   git clone ../remote/repo
   cd repo
-  echo "Mark 3"
   echo "local1 file content" > local1.txt
   metro commit "local1 commit"
-  echo "local1 file content 2" > local1-2.txt
   metro sync
 
-  echo "Mark 4"
+  echo "Mark 2"
   cd ../..
   mkdir local2
   cd local2
-  echo "Mark 5"
   metro clone ../remote/repo
   cd repo
-  echo "Mark 6"
+  echo "local2 file content" > local2.txt
   metro commit "local2 commit"
-  echo "Mark 7"
+  metro branch other
+  echo "other file content" > other.txt
+  metro commit "other commit"
   metro sync
 
-  echo "Mark 8"
+  echo "Mark 3"
   cd ../../local1/repo
   metro sync
-  echo "Mark 9"
+  # Create the local other branch, so that it is synced from now on.
+  metro switch other
+  metro switch master
 
-  run git branch --list
-  [[ "$output" == "* master" ]]
+  echo "Mark 4"
+  cd ../../local2/repo
+  metro switch master
+  echo "local2 file content 2" > local2.txt
+  metro commit "local2 commit 2"
+  metro switch other
+  echo "other file content 2" > other.txt
+  metro commit "other commit 2"
+  metro sync
 
-  run git log master
-  [[ "${lines[3]}" == *"local2 commit"* ]]
+  echo "Mark 5"
+  cd ../../local1/repo
+  echo "local1 wip content" > wip.txt
+  run metro sync
+  [[ "$output" == *"Pulling master..."*"Branch master is ready."*"Pulling other..."* ]]
+  [[ "$(cat local2.txt)" == "local2 file content 2" ]]
+  [[ "$(cat wip.txt)" == "local1 wip content" ]]
+
+  echo "Mark 6"
+  cd ../../local2/repo
+  metro switch master
+  echo "local2 file content 3" > local2.txt
+  metro commit "local2 commit 3"
+  metro switch other
+  echo "other file content 3" > other.txt
+  metro commit "other commit 3"
+  metro sync
+
+  echo "Mark 7"
+  cd ../../local1/repo
+  run metro sync --background
+  [[ "$output" == *"Branch master is ready."* ]]
+  [[ "$(cat local2.txt)" == "local2 file content 3" ]]
+  for i in {1..50}; do
+    [[ "$(git show other:other.txt)" == "other file content 3" ]] && break
+    sleep 0.1
+  done
+  [[ "$(git show other:other.txt)" == "other file content 3" ]]
 }
 
-@test "Sync down changes with unchanged local WIP but changed base" {
+@test "Sync WIP branches in a namespace" {
   git init remote/repo --bare
 
   echo "Mark 1"
   mkdir local1
   cd local1
-  echo "Mark 2"
-  git clone ../remote/repo
+  metro clone ../remote/repo
   cd repo
-  echo "Mark 3"
+  git config metro.wipNamespace alice
   echo "local1 file content" > local1.txt
   metro commit "local1 commit"
-  echo "local1 file content 2" > local1-2.txt
-  echo "local1 file content 3" > local1-3.txt
+  echo "local1 wip content" > wip.txt
   metro sync
+  git --git-dir=../../remote/repo rev-parse --verify refs/metro/wip/alice/master
+  run git --git-dir=../../remote/repo rev-parse --verify "refs/heads/master#wip"
+  [ "$status" -ne 0 ]
 
-  echo "Mark 4"
+  echo "Mark 2"
   cd ../..
   mkdir local2
   cd local2
-  echo "Mark 5"
   metro clone ../remote/repo
   cd repo
-  echo "Mark 6"
-  metro commit "local2 commit"
-  echo "Mark 7"
+  git config metro.wipNamespace bob
+  echo "local2 wip content" > wip.txt
   metro sync
+  [[ "$(cat local1.txt)" == "local1 file content" ]]
+  [[ "$(git for-each-ref --format='%(refname)' | grep alice)" == "" ]]
 
-  echo "Mark 8"
-  cd ../../local1/repo
-  rm local1-3.txt
-  metro commit "local1 commit 2"
-  echo "Mark 9"
-  echo "local1 file content 3" > local1-3.txt
+  echo "Mark 3"
+  cd ../..
+  mkdir local3
+  cd local3
+  git clone ../remote/repo
+  cd repo
+  git config metro.wipNamespace alice
   metro sync
-  echo "Mark 10"
-
-  run git branch --list
-  [[ "${lines[0]}" == "  master" ]]
-  [[ "${lines[1]}" == "* master#1" ]]
-  [[ "${#lines[@]}" == 2 ]]
-
-  run git log master
-  [[ "${lines[3]}" == *"local2 commit"* ]]
-
-  run git log master#1
-  [[ "${lines[3]}" == *"local1 commit 2"* ]]
+  [[ "$(cat wip.txt)" == "local1 wip content" ]]
 }
 
 # ~~~ Test Branch ~~~
@@ -961,6 +1845,38 @@ setup() {
   [[ "${lines[1]}" == "  other" ]]
 }
 
+@test "Switch branch only rewrites changed files" {
+  echo "Mark 1"
+  git init
+
+  echo "Mark 2"
+  echo "Unchanged content" > unchanged.txt
+  echo "Test content 1" > test.txt
+  git add -A
+  git commit -m "Test commit 1"
+  git branch other
+
+  echo "Mark 3"
+  echo "Test content 2" > test.txt
+  echo "New content" > new.txt
+  git add -A
+  git commit -m "Test commit 2"
+  before=$(stat -c %Y unchanged.txt)
+  sleep 1
+
+  echo "Mark 4"
+  metro switch other
+  [[ "$(stat -c %Y unchanged.txt)" == "$before" ]]
+  [[ "$(cat test.txt)" == "Test content 1" ]]
+  [[ ! -e new.txt ]]
+
+  echo "Mark 5"
+  metro switch master
+  [[ "$(stat -c %Y unchanged.txt)" == "$before" ]]
+  [[ "$(cat test.txt)" == "Test content 2" ]]
+  [[ "$(cat new.txt)" == "New content" ]]
+}
+
 # ~~~ Test Delete Branch ~~~
 
 @test "Delete only branch" {
@@ -1720,6 +2636,36 @@ setup() {
   [[ "${lines[2]}" == "Nothing to commit"* ]]
 }
 
+@test "Info caches change counts" {
+  echo "Mark 1"
+  git init
+  git commit --allow-empty -m "Test commit"
+  echo "Test content" > test.txt
+  # Backdate the file so that its stat data can be trusted.
+  touch -d "2020-01-01" test.txt
+  run metro info
+  [[ "${lines[2]}" == "1 file to add"* ]]
+  [ -f .git/metro-status ]
+  run git status --porcelain
+  [[ "$output" == "?? test.txt" ]]
+
+  echo "Mark 2"
+  run metro info
+  [[ "${lines[2]}" == "1 file to add"* ]]
+
+  echo "Mark 3"
+  echo "Test content 2" > test2.txt
+  touch -d "2020-01-01" test2.txt
+  run metro info
+  [[ "${lines[2]}" == "2 files to add"* ]]
+
+  echo "Mark 4"
+  git add -A
+  git commit -m "Add files"
+  run metro info
+  [[ "${lines[2]}" == "Nothing to commit"* ]]
+}
+
 # ~~~ Test Resolve ~~~
 
 @test "Resolve while not absorbing" {
@@ -1925,6 +2871,21 @@ setup() {
     [[ "${lines[1]}" == "  master#wip" ]]
 }
 
+@test "Only save WIP with uncommitted changes" {
+    git init
+    echo "Test file content" > test.txt
+    git add -A
+    git commit -m "Initial Commit"
+
+    touch test.txt
+    run metro wip save
+    [[ "$output" == "No uncommitted changes to save." ]]
+
+    echo "Test file CONTENT" > test.txt
+    metro wip save
+    [[ "$(git show master#wip:test.txt)" == "Test file CONTENT" ]]
+}
+
 @test "Fail to save to WIP branch" {
     git init
     git commit --allow-empty -m "Initial Commit"